@@ -0,0 +1,246 @@
+/*
+
+nh_arena.hpp: a real-time safe allocator for NHHall on Linux.
+
+The default nh_ugens::Allocator gets its memory from malloc, so the first pass
+of a fresh reverb through its delay lines page-faults in the audio thread, and
+long tails spread over many small pages miss the TLB. An Arena instead maps
+one region up front, backed by huge pages where the system has them, writes
+to every page of it so that it is resident, and locks it into RAM. Instances
+then take their delay lines from the arena without any system calls:
+
+    nh_ugens::Arena arena(64 * nh_ugens::NHHall<nh_ugens::ArenaAllocator>::required_bytes(sample_rate));
+    if (!arena.m_initialization_was_successful) {
+        // The region couldn't be mapped.
+        ...
+    }
+
+    nh_ugens::NHHall<nh_ugens::ArenaAllocator> nh_hall(sample_rate, nh_ugens::ArenaAllocator(arena));
+
+Size the arena for the most instances that will be alive at once, plus a
+cache line each. The arena must outlive all of them.
+
+Explicit huge pages (MAP_HUGETLB) are tried first. They need pages reserved
+through /proc/sys/vm/nr_hugepages, which most systems don't have, so the
+arena falls back to normal pages and asks for transparent huge pages with
+madvise. Locking the pages can fail under a low RLIMIT_MEMLOCK. The arena is
+still prefaulted then, only the kernel may swap it out again. uses_huge_pages()
+and is_locked() tell which of these happened.
+
+Freed blocks go on a free list and are handed out again to requests of up to
+their size, so a voice pool that keeps constructing and destroying instances
+at the same sample rate runs in constant memory. Blocks are never split or
+merged. An Arena is not thread safe: construct and destroy the instances
+that use it from one thread at a time.
+
+On other platforms, Arena falls back to a single malloc, which is neither
+locked nor prefaulted.
+
+*/
+
+#pragma once
+#include <cstdint> // uintptr_t
+#include <cstdlib> // malloc / free
+#include <cstring> // memset
+
+#if defined(__linux__)
+#define NH_UGENS_ARENA_MMAP
+#include <sys/mman.h> // mmap / madvise / mlock
+#include <unistd.h> // sysconf
+#endif
+
+namespace nh_ugens {
+
+class Arena {
+public:
+    static constexpr int k_alignment = 64;
+    static constexpr size_t k_huge_page_size = 2 * 1024 * 1024;
+
+    bool m_initialization_was_successful = false;
+
+    explicit Arena(size_t size) {
+        m_size = round_up(size, k_huge_page_size);
+        m_memory = map(m_size);
+        if (m_memory == nullptr) {
+            return;
+        }
+        m_position = align(m_memory);
+        m_end = m_memory + m_size;
+        m_initialization_was_successful = true;
+    }
+
+    ~Arena() {
+        unmap();
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Returns nullptr once the arena is used up.
+    void* allocate(size_t size) {
+        bool zeroed;
+        return allocate(size, zeroed);
+    }
+
+    // Fresh memory from the arena is still zero; only reused blocks are
+    // cleared.
+    void* allocate_zeroed(size_t size) {
+        bool zeroed;
+        void* memory = allocate(size, zeroed);
+        if (memory != nullptr && !zeroed) {
+            memset(memory, 0, size);
+        }
+        return memory;
+    }
+
+    void deallocate(void* memory) {
+        if (memory == nullptr) {
+            return;
+        }
+        Block* block = reinterpret_cast<Block*>(static_cast<char*>(memory) - k_alignment);
+        block->next = m_free;
+        m_free = block;
+    }
+
+    bool uses_huge_pages(void) const {
+        return m_huge_pages;
+    }
+
+    bool is_locked(void) const {
+        return m_locked;
+    }
+
+    // Bytes not yet handed out, not counting the free list.
+    size_t get_remaining_bytes(void) const {
+        return m_initialization_was_successful ? m_end - m_position : 0;
+    }
+
+private:
+    // Each allocation is preceded by a cache line holding its header, which
+    // keeps the allocation itself aligned.
+    struct Block {
+        size_t size;
+        Block* next;
+    };
+
+    char* m_memory = nullptr;
+    size_t m_size = 0;
+    char* m_position = nullptr;
+    char* m_end = nullptr;
+    Block* m_free = nullptr;
+    bool m_huge_pages = false;
+    bool m_locked = false;
+
+    static size_t round_up(size_t size, size_t multiple) {
+        return (size + multiple - 1) / multiple * multiple;
+    }
+
+    static char* align(char* pointer) {
+        uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+        address = (address + k_alignment - 1) & ~static_cast<uintptr_t>(k_alignment - 1);
+        return reinterpret_cast<char*>(address);
+    }
+
+    void* allocate(size_t size, bool& zeroed) {
+        size = round_up(size, k_alignment);
+
+        // First fit from the free list.
+        for (Block** link = &m_free; *link != nullptr; link = &(*link)->next) {
+            Block* block = *link;
+            if (block->size >= size) {
+                *link = block->next;
+                zeroed = false;
+                return reinterpret_cast<char*>(block) + k_alignment;
+            }
+        }
+
+        if (m_position == nullptr || static_cast<size_t>(m_end - m_position) < size + k_alignment) {
+            return nullptr;
+        }
+        Block* block = reinterpret_cast<Block*>(m_position);
+        block->size = size;
+        block->next = nullptr;
+        m_position += size + k_alignment;
+        zeroed = true;
+        return reinterpret_cast<char*>(block) + k_alignment;
+    }
+
+#if defined(NH_UGENS_ARENA_MMAP)
+    char* map(size_t size) {
+        void* memory = mmap(
+            nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0
+        );
+        m_huge_pages = memory != MAP_FAILED;
+        if (!m_huge_pages) {
+            memory = mmap(
+                nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+            );
+            if (memory == MAP_FAILED) {
+                return nullptr;
+            }
+#if defined(MADV_HUGEPAGE)
+            // Must come before the pages are touched.
+            madvise(memory, size, MADV_HUGEPAGE);
+#endif
+        }
+
+        // Write to every page, so that none of them faults later. mlock
+        // would fault them in as well, but it may not be allowed.
+        char* bytes = static_cast<char*>(memory);
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < size; i += page_size) {
+            static_cast<volatile char*>(bytes)[i] = 0;
+        }
+        m_locked = mlock(memory, size) == 0;
+        return bytes;
+    }
+
+    void unmap(void) {
+        if (m_memory == nullptr) {
+            return;
+        }
+        if (m_locked) {
+            munlock(m_memory, m_size);
+        }
+        munmap(m_memory, m_size);
+    }
+#else
+    char* map(size_t size) {
+        char* memory = static_cast<char*>(malloc(size));
+        if (memory != nullptr) {
+            memset(memory, 0, size);
+        }
+        return memory;
+    }
+
+    void unmap(void) {
+        free(m_memory);
+    }
+#endif
+};
+
+// Alloc policy for NHHall that takes memory from an Arena. It is only a
+// pointer to the arena, so every instance keeps its own copy.
+class ArenaAllocator {
+public:
+    explicit ArenaAllocator(Arena& arena) : m_arena(&arena) { }
+
+    void* allocate(int memory_size) {
+        return m_arena->allocate(memory_size);
+    }
+
+    void* allocate_zeroed(int memory_size) {
+        return m_arena->allocate_zeroed(memory_size);
+    }
+
+    void deallocate(void* memory) {
+        m_arena->deallocate(memory);
+    }
+
+private:
+    Arena* m_arena;
+};
+
+} // namespace nh_ugens
@@ -50,7 +50,16 @@ Auraglyph. Special thanks:
 
 USAGE:
 
-NHHall provides only the wet signal. Pre-delay and post-EQ are left up to you.
+By default NHHall outputs only the wet signal. It can also delay its input,
+tilt the wet signal and mix in the dry one, see set_predelay below. The
+predelay needs its longest delay at construction, in seconds, after the late
+rate:
+
+    nh_ugens::NHHall<> nh_hall(sample_rate, nh_ugens::BufferMode::power_of_two, nh_ugens::LateRate::full, 0.5f);
+
+The predelay lines then come out of the same allocation as the rest, so
+required_bytes(), required_bytes_in_place() and create_in_place() take the
+same argument, and so does NHHallPool.
 
 If you don't mind a real-time-unsafe call to malloc when initializing the unit
 (maybe you're in an NRT context, or you're an absolute rascal), instantiate
@@ -76,7 +85,7 @@ the NHHall template with no arguments:
     out_right = result[1];
 
 This uses a default allocator class nh_ugens::Allocator which simply wraps
-malloc and free.
+malloc, calloc and free.
 
 You can replace this with your own allocator class that defines "allocate" and
 "deallocate" methods like this:
@@ -95,26 +104,183 @@ You can replace this with your own allocator class that defines "allocate" and
         }
     };
 
-Then instantiate a std::unique_ptr to a MyAllocator and pass it into the new
-NHHall as a second argument:
+If the allocator can hand out memory that is already zero, such as fresh pages
+from mmap or calloc, give it an "allocate_zeroed" method as well:
+
+        void* allocate_zeroed(int memory_size) {
+            return m_engine->allocate_zeroed(memory_size);
+        }
+
+NHHall then uses that instead of allocate and skips clearing the delay lines,
+which makes constructing many instances much faster and leaves the pages
+untouched until the reverb first writes to them. The default allocator does
+this with calloc.
+
+On Linux, src/core/nh_arena.hpp has an allocator that serves the delay lines
+from one prefaulted, locked region, so that the audio thread never takes a
+page fault.
+
+Then pass a MyAllocator into the new NHHall as a second argument:
+
+    nh_ugens::NHHall<MyAllocator> nh_hall(sample_rate, MyAllocator(engine));
+
+NHHall keeps its own copy of the allocator, moved in, so there is no separate
+heap object for it. A std::unique_ptr<MyAllocator> is accepted as well, and
+its allocator is moved out. After this initialization, use of the unit is
+unchanged from the above.
+
+NHHall can be moved, which hands over its delay lines, but not copied. So it
+can be kept by value in a std::vector or a pool. A moved-from NHHall may only
+be destroyed or assigned to. Moving is noexcept as long as moving the
+allocator is.
+
+A host that wants the object and its delay lines in one block of its own
+memory can build an NHHall in place:
+
+    int bytes = nh_ugens::NHHall<>::required_bytes_in_place(sample_rate);
+    void* memory = ...;
+    nh_ugens::NHHall<>* nh_hall = nh_ugens::NHHall<>::create_in_place(memory, bytes, sample_rate);
+    ...
+    nh_hall->~NHHall();
+
+Nothing is allocated. create_in_place returns nullptr if the memory is too
+small. The buffer mode and late rate (see below) follow the sample rate as
+optional arguments, as in the constructor.
+
+NHHall makes a single allocation for all of its delay lines, of exactly
+
+    int bytes = nh_ugens::NHHall<>::required_bytes(sample_rate);
+
+so a real-time host can reserve that much ahead of time. The memory needn't be
+aligned; NHHall aligns the delay lines to cache lines itself. required_bytes is
+constexpr.
 
-    nh_ugens::NHHall<MyAllocator> nh_hall(
-        sample_rate,
-        std::unique_ptr<MyAllocator>(new MyAllocator(engine))
-    );
+By default every delay buffer is rounded up to a power of two, which wastes
+about a third of that memory. Exact buffers save it, but cost CPU: in
+test/benchmark they run 15 to 60 percent slower than power-of-two buffers,
+depending on the machine, and that holds for 64 instances too, where the
+smaller buffers fit better in cache. Use them when memory is what runs out.
+Pass the buffer mode as the last constructor argument, and to required_bytes:
 
-The std::unique_ptr is passed into the NHHall with move semantics. I'm sorry if
-that's a little complicated, but it ensures that the MyAllocator isn't
-unceremoniously tampered with after NHHall receives it and makes the program
-easier to reason about. After this initialization, use of the unit is unchanged
-from the above.
+    nh_ugens::NHHall<> nh_hall(sample_rate, nh_ugens::BufferMode::exact);
 
-If the allocator ever returns a null pointer during initialization, NHHall
-immediately stops all further allocation and sets the
+The output is the same either way, up to float rounding in the modulated
+allpasses.
+
+For dense instance counts on slow machines there is an "eco" mode, which runs
+the late network at half or quarter of the sample rate. The early section and
+the output mix stay at full rate; the late network's input is decimated and
+its output interpolated back up with polyphase half-band filters. The tail
+then has nothing above about 40% of the reduced Nyquist frequency, which the
+hi shelf would mostly have damped anyway, the late delay lines take half or a
+quarter of the memory, and the whole reverb costs roughly 30% (half rate)
+or 50% (quarter rate) less. Pass the rate after the buffer mode, to the
+constructor and to required_bytes:
+
+    nh_ugens::NHHall<> nh_hall(sample_rate, nh_ugens::BufferMode::power_of_two, nh_ugens::LateRate::half);
+
+Below full rate, set_mod_control_period counts samples at the reduced rate.
+NHHallBank always runs at full rate.
+
+The second template parameter of NHHall picks how delay buffers store their
+samples. Processing is always in float; HalfStorage and Int16Storage keep the
+buffers in 16 bits, which halves the memory of an instance:
+
+    nh_ugens::NHHall<nh_ugens::Allocator, nh_ugens::HalfStorage> nh_hall(sample_rate);
+
+Half floats add noise about 66 dB below the signal and follow the tail all the
+way down. Int16Storage has a fixed noise floor, clips signals in the delay
+lines beyond +-8, and the end of a tail may settle into a quiet limit cycle
+rather than decaying to silence.
+
+Both are a memory saving paid for in CPU, as every read and write of a delay
+line converts. In test/benchmark, Int16Storage is about twice as slow as
+FloatStorage. HalfStorage needs the F16C instructions: built with -mf16c (or
+an -march that has them) it is about 1.5 times as slow, but without them it
+converts in software and is about 4 times as slow. This holds for 64
+instances too, where the float buffers no longer fit in cache. NHHallBank
+always stores floats.
+
+The third template parameter picks the interpolation of the modulated
+allpasses, from cheapest to most accurate: LinearInterpolation,
+AllpassInterpolation (first order), CubicInterpolation (the default) and
+LagrangeInterpolation (fifth order):
+
+    nh_ugens::NHHall<nh_ugens::Allocator, nh_ugens::FloatStorage, nh_ugens::LinearInterpolation> nh_hall(sample_rate);
+
+Linear and cubic interpolation lose a little treble on every pass through the
+loop, linear more so, which shortens the tail at high frequencies. The allpass
+keeps all of it. NHHallBank always uses cubic interpolation.
+
+If the allocator returns a null pointer during initialization, NHHall sets the
 m_initialization_was_successful flag to false. You should always check that
 flag and make sure it worked. If you forget to do this, running NHHall.process
 will access garbage memory and probably crash your app.
 
+If your host hands you blocks of audio, prefer the block processing methods,
+which avoid the per-call overhead and run each delay line over many samples at
+a time. They produce exactly the same output as calling process() once per
+sample:
+
+    // Separate channel buffers:
+    nh_hall.process_block(in_left, in_right, out_left, out_right, frames);
+    // In place:
+    nh_hall.process_block(left, right, frames);
+    // Interleaved (L R L R ...), optionally in place:
+    nh_hall.process_block_interleaved(in, out, frames);
+    nh_hall.process_block_interleaved(buffer, frames);
+
+If you run many reverbs at the same sample rate, nh_ugens::NHHallBank<N>
+processes N of them at once, four lanes per SIMD vector, which is
+considerably cheaper than N separate NHHall instances. Each lane has its own
+parameters and produces the same output as an NHHall with those settings;
+its shelves, too, are worked out again whenever its m_k changes. N must be a
+multiple of 4. The setters take the lane as an extra first
+argument, and process_block takes one buffer pointer per lane and channel:
+
+    nh_ugens::NHHallBank<8> bank(sample_rate);
+    bank.set_rt60(lane, 3.0f);
+    ...
+    bank.process_block(in_left, in_right, out_left, out_right, frames);
+
+Left alone, a decaying tail ends in denormals, which are very slow on most
+CPUs. By default NHHall flushes them in software on every write to a feedback
+path. Define NH_UGENS_FTZ before including this file to have the FPU do it
+instead: processing then runs under an nh_ugens::DenormalGuard, which sets
+FTZ/DAZ on x86 or FZ on AArch64 and restores the previous mode on return. On
+other platforms NH_UGENS_FTZ is ignored. The guard is public, so a host can
+also hold one around all of its processing.
+
+An idle reverb still costs as much as a busy one. With auto sleep on, NHHall
+goes to sleep once its input has been quiet for a quarter of a second and
+its output has decayed below a threshold, and then outputs zeros at almost
+no cost until the input comes back:
+
+    nh_hall.set_auto_sleep(true);
+
+Going to sleep silences all of the reverb's state, so it wakes up exactly as
+a freshly constructed one would, with nothing cut off but a tail below the
+threshold. For the same reason, auto sleep gives up the exact match between
+process() and process_block(): they may fall asleep a few samples apart.
+NHHallBank has no auto sleep.
+
+For a reverb per voice in a polyphonic synth, nh_ugens::NHHallPool<M> builds
+M voices up front in a single allocation, with auto sleep on, and hands them
+out and takes them back without allocating:
+
+    nh_ugens::NHHallPool<16> pool(sample_rate);
+    int index = pool.acquire();  // note on
+    pool.voice(index).set_rt60(2.0f);
+    pool.voice(index).process_block(in_left, in_right, out_left, out_right, frames);
+    pool.release(index);  // note off
+
+A released voice keeps ringing until it falls asleep, so keep processing it
+while pool.is_active(index). When every voice is busy, acquire() steals the
+one with the least tail left, going by tail_remaining_samples() and taking
+released voices before held ones. The previous owner of a stolen voice has
+to let go of it, as with any voice allocator. An acquired voice is reset but
+keeps its settings.
+
 The following settings are available:
 
     NHHall.set_rt60(float rt60)
@@ -127,6 +293,16 @@ The following settings are available:
     NHHall.set_low_shelf_parameters(float frequency, float ratio)
     NHHall.set_hi_shelf_parameters(float frequency, float ratio)
         Set the frequency cutoffs and decay ratios of the damping filters.
+        The ratios are relative to the decay time, so the filters are worked
+        out at the start of the next block, and again whenever m_k changes.
+        Both shelves run as one biquad per late branch.
+
+    NHHall.set_dc_blocker(bool dc_blocker)
+        Remove DC from the late branches with a 3 Hz highpass after the
+        damping. Off by default. Turn it on for hold reverbs, where m_k is 1:
+        neither shelf takes anything off at 0 Hz then, so a DC offset or
+        subsonic rumble in the input stays in the tail for good. NHHallBank
+        has no DC blocker.
 
     NHHall.set_early_diffusion(float diffusion)
     NHHall.set_late_diffusion(float diffusion)
@@ -136,10 +312,71 @@ The following settings are available:
     NHHall.set_mod_depth(float mod_depth)
         Rate and depth of LFO. These are arbitrarily scaled so that 0..1 offers
         musically useful ranges.
+        A depth of 0 switches the late variable allpasses to fixed integer
+        delays and stops evaluating the LFO, which makes NHHall noticeably
+        cheaper. Switching between zero and nonzero depth crossfades over 10 ms.
+        NHHallBank always runs the modulated path.
 
     NHHall.seed(uint32_t seed)
         Seed the random LFO. By default, the LFO has a fixed seed.
 
+    NHHall.set_exact_lfo(bool exact)
+        The LFO is an incremental quadrature oscillator by default. Passing
+        true evaluates sinf and cosf on every sample instead, which is slower
+        and sounds the same.
+
+    NHHall.set_mod_control_period(int period)
+        Evaluate the LFO only once every period samples, and ramp the modulated
+        delay times linearly in between. The LFO is slow enough that periods up
+        to a few dozen samples are inaudible, and this saves most of the cost
+        of the modulation. The default of 1 evaluates it on every sample.
+        NHHallBank has this setter without a lane argument, because the period
+        is shared by all lanes.
+
+    NHHall.set_auto_sleep(bool auto_sleep)
+        Let the reverb sleep while it is silent, see above. Off by default.
+
+    NHHall.set_sleep_threshold(float threshold_db)
+        The output and input power, in dB, below which the reverb counts as
+        silent. The default is -120 dB.
+
+    bool NHHall.is_sleeping()
+    int NHHall.tail_remaining_samples()
+        Whether the reverb is asleep, and if not, an upper estimate of how
+        many samples of silent input it will take to get there, worked out
+        from the current output level and m_k. A scheduler can use these to
+        skip sleeping instances or plan around their tails.
+
+    NHHall.reset()
+        Silence the reverb and restart the LFO, keeping all settings, so that
+        it sounds exactly like a freshly constructed one. Only the parts of the
+        delay lines written since the last reset are cleared, so resetting a
+        voice that played for a few milliseconds is nearly free. NHHallBank
+        has no reset.
+
+    NHHall.set_predelay(float seconds)
+        Delay the input of the reverb, up to the max_predelay given to the
+        constructor. Changing it jumps.
+
+    NHHall.set_tilt(float frequency, float db)
+        Tilt EQ on the wet signal: raise the treble and lower the bass by
+        db / 2 each, pivoting at frequency. Negative db darken the reverb.
+
+    NHHall.set_dry_wet(float dry, float wet)
+    NHHall.set_output_gain(float gain)
+        Linear gains of the dry and wet signals in the output, 0 and 1 by
+        default, and of the whole output.
+        Until one of these four is called, NHHall skips them entirely. After
+        that, they run in the same pass as the reverb over each chunk of at
+        most 128 samples, so the audio goes through memory once. The dry
+        signal is copied aside, so in-place processing still works.
+        NHHallBank has none of these.
+
+    NHHall.set_smoothing_time(float seconds)
+        Ramp to new settings linearly over this time instead of jumping, see
+        below. 0, the default, switches at once. Setting it back to 0 skips
+        to the end of any ramp in progress, and so does reset().
+
 Instead of using set_rt60, you can also use the utility function
 
     float NHHall.compute_k_from_rt60(float rt60)
@@ -149,27 +386,266 @@ time, it's better to linearly interpolate m_k than to interpolate rt60, because
 m_k may be 1 for an infinite hold reverb, putting rt60 at infinity. Trying to
 interpolate from a finite value to infinity is asking for trouble.
 
-Speaking of interpolation, it's your responsibility to smooth out these
-parameters to avoid clicks when modulating them. All parameters are worth
-smoothing out except mod_rate, which only checks its frequency parameter
-occasionally.
+Speaking of interpolation, changing parameters abruptly can click. Either
+smooth them out yourself, or let NHHall do it:
+
+    nh_hall.set_smoothing_time(0.02f);
+
+Then each setter only sets a target, and m_k, the stereo rotation, both
+diffusions, the shelf coefficients and the output stage ramp to their targets,
+sample by sample, over the next 20 ms. A setter called during a ramp starts a
+new one from where the coefficients are. With smoothing on, change m_k through
+
+    NHHall.set_k(float k)
+
+rather than directly. The rotation ramps cos and sin linearly, which is close
+enough to a rotation for this purpose. The LFO settings aren't smoothed;
+mod_rate only checks its frequency parameter occasionally anyway. NHHallBank
+has no smoothing.
+
+The setters are not thread safe. To change parameters from a control thread
+while the audio thread is processing, post them instead:
+
+    nh_hall.post_parameter(nh_ugens::Parameter::rt60, 3.0f);
+    nh_hall.post_parameter(nh_ugens::Parameter::hi_shelf, 4000.0f, 0.5f);
+
+post_parameter pushes the change onto a wait-free single-producer,
+single-consumer queue, which the reverb drains at the start of every block.
+Only one thread may post to an NHHall. Several changes of one parameter
+within a block collapse into the last one, a change to the value it already
+has is skipped, and rt60 is applied before the shelves, which follow it.
+post_parameter returns false if the queue is full, which takes 63 pending
+changes.
+
+For automation that has to land on an exact sample, pass the changes to
+process_block as events, sorted by their offset into the block:
+
+    nh_ugens::ParameterEvent events[] = {
+        {0, {nh_ugens::Parameter::rt60, 3.0f, 0.0f}},
+        {96, {nh_ugens::Parameter::k, 1.0f, 0.0f}},  // Infinite hold on the beat.
+    };
+    nh_hall.process_block(in_left, in_right, out_left, out_right, frames, events, 2);
+
+The block is split at the events and the parts run through the usual block
+processing, so the result is exactly that of calling the setters between
+process() calls, at close to the speed of an unsplit block. Parameter::k
+sets m_k directly, like set_k. Events are applied on the audio thread, so
+they need no queue.
 
 */
 
 #pragma once
+#include <cstdint> // uintptr_t
 #include <cstdlib> // malloc / free
 #include <cstring> // memset
 #include <memory> // std::unique_ptr
+#include <utility> // std::move
+#include <new> // placement new
+#include <type_traits> // std::aligned_storage, std::true_type, std::is_nothrow_move_constructible
 #include <array> // std::array
 #include <cmath> // cosf/sinf
+#include <limits> // std::numeric_limits
+#include <atomic> // std::atomic
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NH_UGENS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define NH_UGENS_NEON
+#include <arm_neon.h>
+#endif
+
+// With NH_UGENS_FTZ defined, NHHall sets the FPU to flush denormals to zero
+// while it processes, instead of flushing them in software on every feedback
+// write. See DenormalGuard.
+#if defined(NH_UGENS_FTZ) && (defined(NH_UGENS_SSE2) || (defined(__aarch64__) && defined(__GNUC__)))
+#define NH_UGENS_HARDWARE_FTZ
+#endif
+
+// Hardware half-float conversion for HalfStorage, with -mf16c. Without it
+// HalfStorage converts in software, several times slower.
+#if defined(__F16C__)
+#define NH_UGENS_F16C
+#include <immintrin.h>
+#endif
 
 namespace nh_ugens {
 
 typedef std::array<float, 2> Stereo;
 
-static inline float flush_denormals(float x) {
-    x += 1.0e-25;
-    x -= 1.0e-25;
+// Four floats processed in lockstep, used to run the four late branches of
+// the reverb side by side. Uses SSE2 or NEON where available. All operations
+// are lane-wise and give the same results as the scalar float operations.
+class Float4 {
+public:
+    Float4() { }
+
+    explicit Float4(float x) {
+#if defined(NH_UGENS_SSE2)
+        m_value = _mm_set1_ps(x);
+#elif defined(NH_UGENS_NEON)
+        m_value = vdupq_n_f32(x);
+#else
+        for (int i = 0; i < 4; i++) {
+            m_value[i] = x;
+        }
+#endif
+    }
+
+    Float4(float x0, float x1, float x2, float x3) {
+        float x[4] = {x0, x1, x2, x3};
+        *this = load(x);
+    }
+
+    static Float4 load(const float* x) {
+        Float4 result;
+#if defined(NH_UGENS_SSE2)
+        result.m_value = _mm_loadu_ps(x);
+#elif defined(NH_UGENS_NEON)
+        result.m_value = vld1q_f32(x);
+#else
+        for (int i = 0; i < 4; i++) {
+            result.m_value[i] = x[i];
+        }
+#endif
+        return result;
+    }
+
+    static Float4 load(const int* x) {
+        Float4 result;
+#if defined(NH_UGENS_SSE2)
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x));
+        result.m_value = _mm_cvtepi32_ps(value);
+#elif defined(NH_UGENS_NEON)
+        result.m_value = vcvtq_f32_s32(vld1q_s32(x));
+#else
+        for (int i = 0; i < 4; i++) {
+            result.m_value[i] = x[i];
+        }
+#endif
+        return result;
+    }
+
+    void store(float* x) const {
+#if defined(NH_UGENS_SSE2)
+        _mm_storeu_ps(x, m_value);
+#elif defined(NH_UGENS_NEON)
+        vst1q_f32(x, m_value);
+#else
+        for (int i = 0; i < 4; i++) {
+            x[i] = m_value[i];
+        }
+#endif
+    }
+
+    // Round toward zero like a cast to int. The integers are written to out
+    // and returned as floats.
+    Float4 truncate(int* out) const {
+        Float4 result;
+#if defined(NH_UGENS_SSE2)
+        __m128i value = _mm_cvttps_epi32(m_value);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), value);
+        result.m_value = _mm_cvtepi32_ps(value);
+#elif defined(NH_UGENS_NEON)
+        int32x4_t value = vcvtq_s32_f32(m_value);
+        vst1q_s32(out, value);
+        result.m_value = vcvtq_f32_s32(value);
+#else
+        for (int i = 0; i < 4; i++) {
+            out[i] = m_value[i];
+            result.m_value[i] = out[i];
+        }
+#endif
+        return result;
+    }
+
+#if defined(NH_UGENS_SSE2)
+#define NH_UGENS_FLOAT4_OPERATOR(op, sse, neon) \
+    friend Float4 operator op(Float4 a, Float4 b) { \
+        Float4 result; \
+        result.m_value = sse(a.m_value, b.m_value); \
+        return result; \
+    }
+#elif defined(NH_UGENS_NEON)
+#define NH_UGENS_FLOAT4_OPERATOR(op, sse, neon) \
+    friend Float4 operator op(Float4 a, Float4 b) { \
+        Float4 result; \
+        result.m_value = neon(a.m_value, b.m_value); \
+        return result; \
+    }
+#else
+#define NH_UGENS_FLOAT4_OPERATOR(op, sse, neon) \
+    friend Float4 operator op(Float4 a, Float4 b) { \
+        Float4 result; \
+        for (int i = 0; i < 4; i++) { \
+            result.m_value[i] = a.m_value[i] op b.m_value[i]; \
+        } \
+        return result; \
+    }
+#endif
+
+    NH_UGENS_FLOAT4_OPERATOR(+, _mm_add_ps, vaddq_f32)
+    NH_UGENS_FLOAT4_OPERATOR(-, _mm_sub_ps, vsubq_f32)
+    NH_UGENS_FLOAT4_OPERATOR(*, _mm_mul_ps, vmulq_f32)
+
+#undef NH_UGENS_FLOAT4_OPERATOR
+
+    friend Float4 operator*(float a, Float4 b) {
+        return Float4(a) * b;
+    }
+
+    friend Float4 operator/(Float4 a, Float4 b) {
+        Float4 result;
+#if defined(NH_UGENS_SSE2)
+        result.m_value = _mm_div_ps(a.m_value, b.m_value);
+#elif defined(NH_UGENS_NEON) && defined(__aarch64__)
+        result.m_value = vdivq_f32(a.m_value, b.m_value);
+#elif defined(NH_UGENS_NEON)
+        // 32-bit NEON has no division. Refine the reciprocal estimate twice.
+        float32x4_t reciprocal = vrecpeq_f32(b.m_value);
+        reciprocal = vmulq_f32(vrecpsq_f32(b.m_value, reciprocal), reciprocal);
+        reciprocal = vmulq_f32(vrecpsq_f32(b.m_value, reciprocal), reciprocal);
+        result.m_value = vmulq_f32(a.m_value, reciprocal);
+#else
+        for (int i = 0; i < 4; i++) {
+            result.m_value[i] = a.m_value[i] / b.m_value[i];
+        }
+#endif
+        return result;
+    }
+
+    friend Float4 operator-(Float4 a) {
+        Float4 result;
+#if defined(NH_UGENS_SSE2)
+        result.m_value = _mm_xor_ps(a.m_value, _mm_set1_ps(-0.0f));
+#elif defined(NH_UGENS_NEON)
+        result.m_value = vnegq_f32(a.m_value);
+#else
+        for (int i = 0; i < 4; i++) {
+            result.m_value[i] = -a.m_value[i];
+        }
+#endif
+        return result;
+    }
+
+private:
+#if defined(NH_UGENS_SSE2)
+    __m128 m_value;
+#elif defined(NH_UGENS_NEON)
+    float32x4_t m_value;
+#else
+    float m_value[4];
+#endif
+};
+
+// Adding and subtracting a tiny constant rounds denormals to zero. Not needed
+// when the FPU does it, see DenormalGuard.
+template <class T>
+static inline T flush_denormals(T x) {
+#if !defined(NH_UGENS_HARDWARE_FTZ)
+    x = x + T(1.0e-25f);
+    x = x - T(1.0e-25f);
+#endif
     return x;
 }
 
@@ -178,22 +654,161 @@ static inline Stereo flush_denormals(Stereo x) {
     return result;
 }
 
-static inline int next_power_of_two(int x) {
-    int result = 1;
-    while (result < x) {
-        result *= 2;
+// Sets the FPU to flush denormal results to zero and to treat denormal inputs
+// as zero (FTZ and DAZ in MXCSR on x86, FZ in FPCR on AArch64) for as long as
+// it lives, and restores the previous mode afterwards. The control register is
+// only written if the mode isn't already set, so a host that sets it once for
+// its audio thread pays for a read per block. Does nothing on other platforms.
+class DenormalGuard {
+public:
+    DenormalGuard() {
+#if defined(NH_UGENS_SSE2)
+        m_previous = _mm_getcsr();
+        if ((m_previous & k_flags) != k_flags) {
+            _mm_setcsr(m_previous | k_flags);
+        }
+#elif defined(__aarch64__) && defined(__GNUC__)
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(m_previous));
+        if ((m_previous & k_flags) != k_flags) {
+            uint64_t fpcr = m_previous | k_flags;
+            __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+        }
+#endif
     }
-    return result;
+
+    ~DenormalGuard() {
+#if defined(NH_UGENS_SSE2)
+        if ((m_previous & k_flags) != k_flags) {
+            _mm_setcsr(m_previous);
+        }
+#elif defined(__aarch64__) && defined(__GNUC__)
+        if ((m_previous & k_flags) != k_flags) {
+            __asm__ __volatile__("msr fpcr, %0" : : "r"(m_previous));
+        }
+#endif
+    }
+
+    DenormalGuard(const DenormalGuard&) = delete;
+    DenormalGuard& operator=(const DenormalGuard&) = delete;
+
+private:
+#if defined(NH_UGENS_SSE2)
+    static constexpr unsigned int k_flags = 0x8040;
+    unsigned int m_previous;
+#elif defined(__aarch64__) && defined(__GNUC__)
+    static constexpr uint64_t k_flags = 1 << 24;
+    uint64_t m_previous;
+#endif
+};
+
+static constexpr int next_power_of_two(int x, int result = 1) {
+    return result < x ? next_power_of_two(x, 2 * result) : result;
 }
 
-static float interpolate_cubic(float x, float y0, float y1, float y2, float y3) {
-    float c0 = y1;
-    float c1 = y2 - 1 / 3.0 * y0 - 1 / 2.0 * y1 - 1 / 6.0 * y3;
-    float c2 = 1 / 2.0 * (y0 + y2) - y1;
-    float c3 = 1 / 6.0 * (y3 - y0) + 1 / 2.0 * (y1 - y2);
+// Works on float or Float4.
+template <class T>
+static inline T interpolate_cubic(T x, T y0, T y1, T y2, T y3) {
+    T c0 = y1;
+    T c1 = y2 - (1 / 3.0f) * y0 - (1 / 2.0f) * y1 - (1 / 6.0f) * y3;
+    T c2 = (1 / 2.0f) * (y0 + y2) - y1;
+    T c3 = (1 / 6.0f) * (y3 - y0) + (1 / 2.0f) * (y1 - y2);
     return ((c3 * x + c2) * x + c1) * x + c0;
 }
 
+// Interpolation policies for VariableAllpass. A policy reads k_taps
+// consecutive samples y, starting k_first_tap samples after the integer part
+// of the read position, and interpolates at the fraction x past the second
+// sample of that position. state belongs to the delay line and starts at
+// zero. Works on float or Float4.
+
+// Two taps. Cheapest, but the modulation audibly dulls the highs.
+class LinearInterpolation {
+public:
+    static constexpr int k_first_tap = 1;
+    static constexpr int k_taps = 2;
+
+    template <class T>
+    static inline T interpolate(T x, const T* y, T&) {
+        return y[0] + x * (y[1] - y[0]);
+    }
+};
+
+// First-order allpass, as in Dattorro's plate: flat magnitude response, but
+// it has its own state, and the phase response smears as the delay moves.
+class AllpassInterpolation {
+public:
+    static constexpr int k_first_tap = 1;
+    static constexpr int k_taps = 3;
+
+    template <class T>
+    static inline T interpolate(T x, const T* y, T& state) {
+        // Past the halfway point, use the later pair of taps. This keeps the
+        // fractional delay d in (0.5, 1.5], and the pole within 1/3.
+        T later = round_half_up(x);
+        T newest = y[1] + later * (y[2] - y[1]);
+        T oldest = y[0] + later * (y[1] - y[0]);
+        T d = T(1.0f) + later - x;
+        T eta = (T(1.0f) - d) / (T(1.0f) + d);
+        state = eta * (newest - state) + oldest;
+        return state;
+    }
+
+private:
+    // 0 or 1, for x in [0, 1).
+    static inline float round_half_up(float x) {
+        return x < 0.5f ? 0.0f : 1.0f;
+    }
+
+    static inline Float4 round_half_up(Float4 x) {
+        int ignored[4];
+        return (x + Float4(0.5f)).truncate(ignored);
+    }
+};
+
+// Four-point, third-order Lagrange. The default.
+class CubicInterpolation {
+public:
+    static constexpr int k_first_tap = 0;
+    static constexpr int k_taps = 4;
+
+    template <class T>
+    static inline T interpolate(T x, const T* y, T&) {
+        return interpolate_cubic(x, y[0], y[1], y[2], y[3]);
+    }
+};
+
+// Six-point, fifth-order Lagrange. Flatter than the cubic up to higher
+// frequencies, at about twice the cost.
+class LagrangeInterpolation {
+public:
+    static constexpr int k_first_tap = -1;
+    static constexpr int k_taps = 6;
+
+    template <class T>
+    static inline T interpolate(T x, const T* y, T&) {
+        // Products of (d - m) over the taps m before and after each tap k,
+        // for the position d = x + 2 counted from the first tap.
+        T d = x + T(2.0f);
+        T before[6];
+        T after[6];
+        before[0] = T(1.0f);
+        after[5] = T(1.0f);
+        for (int k = 1; k < 6; k++) {
+            before[k] = before[k - 1] * (d - T(static_cast<float>(k - 1)));
+            after[5 - k] = after[6 - k] * (d - T(static_cast<float>(6 - k)));
+        }
+        // The denominators, prod over m != k of (k - m).
+        const float scale[6] = {
+            -1 / 120.0f, 1 / 24.0f, -1 / 12.0f, 1 / 12.0f, -1 / 24.0f, 1 / 120.0f
+        };
+        T result = y[0] * (before[0] * after[0] * T(scale[0]));
+        for (int k = 1; k < 6; k++) {
+            result = result + y[k] * (before[k] * after[k] * T(scale[k]));
+        }
+        return result;
+    }
+};
+
 // Unitary rotation matrix.
 static inline Stereo rotate(Stereo x, float cos, float sin) {
     Stereo result = {
@@ -203,6 +818,29 @@ static inline Stereo rotate(Stereo x, float cos, float sin) {
     return result;
 }
 
+static inline void rotate(float* left, float* right, int n, float cos, float sin) {
+    for (int i = 0; i < n; i++) {
+        Stereo x = {{left[i], right[i]}};
+        x = rotate(x, cos, sin);
+        left[i] = x[0];
+        right[i] = x[1];
+    }
+}
+
+// The same, adding cos_step and sin_step after each sample.
+static inline void rotate(
+    float* left, float* right, int n, float cos, float sin, float cos_step, float sin_step
+) {
+    for (int i = 0; i < n; i++) {
+        Stereo x = {{left[i], right[i]}};
+        x = rotate(x, cos, sin);
+        left[i] = x[0];
+        right[i] = x[1];
+        cos += cos_step;
+        sin += sin_step;
+    }
+}
+
 constexpr float twopi = 6.283185307179586f;
 
 // Default allocator -- not real-time safe!
@@ -212,11 +850,85 @@ public:
         return malloc(memory_size);
     }
 
+    // calloc takes large blocks straight from the OS as zero pages, which it
+    // doesn't need to clear, and which stay untouched until first written.
+    void* allocate_zeroed(int memory_size) {
+        return calloc(1, memory_size);
+    }
+
     void deallocate(void* memory) {
         free(memory);
     }
 };
 
+// Allocator for NHHall instances whose delay lines are carved from memory
+// owned by someone else, such as the voices of an NHHallPool. They never call
+// it, so it holds nothing and hands out nothing.
+class NullAllocator {
+public:
+    void* allocate(int) {
+        return nullptr;
+    }
+
+    void deallocate(void*) {
+    }
+};
+
+// Whether an allocator class has an allocate_zeroed method.
+template <class Alloc>
+class HasAllocateZeroed {
+    template <class A>
+    static std::true_type test(decltype(&A::allocate_zeroed));
+    template <class A>
+    static std::false_type test(...);
+
+public:
+    static constexpr bool value = decltype(test<Alloc>(nullptr))::value;
+};
+
+// The allocator of an NHHall, kept by value, and the slab it allocated, if
+// any. Moving it hands the slab over, which is what lets NHHall move by
+// moving its members.
+template <class Alloc>
+class OwnedSlab {
+public:
+    Alloc m_allocator;
+    void* m_memory = nullptr;
+
+    explicit OwnedSlab(Alloc allocator) : m_allocator(std::move(allocator)) { }
+
+    OwnedSlab(OwnedSlab&& other) noexcept(std::is_nothrow_move_constructible<Alloc>::value) :
+    m_allocator(std::move(other.m_allocator)),
+    m_memory(other.m_memory)
+    {
+        other.m_memory = nullptr;
+    }
+
+    OwnedSlab& operator=(OwnedSlab&& other) noexcept(std::is_nothrow_move_assignable<Alloc>::value) {
+        if (this != &other) {
+            release();
+            m_allocator = std::move(other.m_allocator);
+            m_memory = other.m_memory;
+            other.m_memory = nullptr;
+        }
+        return *this;
+    }
+
+    OwnedSlab(const OwnedSlab&) = delete;
+    OwnedSlab& operator=(const OwnedSlab&) = delete;
+
+    ~OwnedSlab() {
+        release();
+    }
+
+    void release(void) {
+        if (m_memory != nullptr) {
+            m_allocator.deallocate(m_memory);
+            m_memory = nullptr;
+        }
+    }
+};
+
 // Quadrature sine LFO, not used.
 class SineLFO {
 public:
@@ -258,9 +970,26 @@ public:
     }
 
     inline void seed(uint32_t seed) {
+        m_seed = seed;
         m_lcg_state = seed;
     }
 
+    // Start over from the seed, keeping rate, depth and mode.
+    void reset(void) {
+        m_lcg_state = m_seed;
+        m_timeout = 0;
+        m_increment = 0.f;
+        m_phase = 0.f;
+        m_segment_phase = 0.f;
+        m_segment_position = 0;
+        m_resync = true;
+        m_sin = 0.f;
+        m_cos = 1.f;
+        m_step_one_minus_cos = 0.f;
+        m_step_sin = 0.f;
+        m_renormalize_timeout = 0;
+    }
+
     inline uint16_t run_lcg(void) {
         m_lcg_state = m_lcg_state * 22695477 + 1;
         uint16_t result = m_lcg_state >> 16;
@@ -281,14 +1010,82 @@ public:
         update_amplitude();
     }
 
+    // By default the LFO is a quadrature oscillator that rotates its
+    // (sin, cos) state by the phase increment every sample. The exact mode
+    // calls sinf and cosf on every sample instead. The rotation is resynced
+    // to the exact phase at the start of every segment of the random walk,
+    // so the two differ by at most about 4e-4 of the amplitude, and far less
+    // at higher rates.
+    void set_exact(bool exact) {
+        m_exact = exact;
+        m_resync = true;
+    }
+
     Stereo process(void) {
         if (m_timeout <= 0) {
-            m_timeout = run_lcg() * 0.1f / m_frequency * m_sample_rate / 48000.0f;
-            m_increment = (run_lcg() * (1.0f / 32767.0f) - 0.5f) * m_frequency / m_sample_rate;
+            start_segment();
         }
         m_timeout -= 1;
-        m_phase += m_increment;
-        // TODO: optimize
+        m_segment_position += 1;
+        m_phase = m_segment_phase + m_increment * m_segment_position;
+
+        if (m_exact) {
+            Stereo result = {{
+                sinf(m_phase) * m_amplitude,
+                cosf(m_phase) * m_amplitude
+            }};
+            return result;
+        }
+
+        if (m_resync) {
+            m_sin = sinf(m_phase);
+            m_cos = cosf(m_phase);
+            m_resync = false;
+            m_renormalize_timeout = k_renormalize_period;
+        } else {
+            float next_sin = m_sin - m_sin * m_step_one_minus_cos + m_cos * m_step_sin;
+            float next_cos = m_cos - m_cos * m_step_one_minus_cos - m_sin * m_step_sin;
+            m_sin = next_sin;
+            m_cos = next_cos;
+            m_renormalize_timeout -= 1;
+            if (m_renormalize_timeout <= 0) {
+                // One Newton step toward sin^2 + cos^2 = 1.
+                float gain = 1.5f - 0.5f * (m_sin * m_sin + m_cos * m_cos);
+                m_sin *= gain;
+                m_cos *= gain;
+                m_renormalize_timeout = k_renormalize_period;
+            }
+        }
+
+        Stereo result = {{m_sin * m_amplitude, m_cos * m_amplitude}};
+        return result;
+    }
+
+    void process(float* out_sin, float* out_cos, int n) {
+        for (int i = 0; i < n; i++) {
+            Stereo result = process();
+            out_sin[i] = result[0];
+            out_cos[i] = result[1];
+        }
+    }
+
+    // Skip ahead by n samples and return the value there, as if process()
+    // had been called n times. This walks the same random path, a whole
+    // segment at a time, for callers that only need the LFO at control rate.
+    // advance(0) returns the current value.
+    Stereo advance(int n) {
+        while (n > 0) {
+            if (m_timeout <= 0) {
+                start_segment();
+            }
+            int step = std::max(std::min(n, m_timeout), 1);
+            m_timeout -= step;
+            m_segment_position += step;
+            m_phase = m_segment_phase + m_increment * m_segment_position;
+            n -= step;
+        }
+        m_resync = true;
+
         Stereo result = {{
             sinf(m_phase) * m_amplitude,
             cosf(m_phase) * m_amplitude
@@ -297,7 +1094,8 @@ public:
     }
 
 private:
-    const float m_sample_rate;
+    float m_sample_rate;
+    uint32_t m_seed = 1;
     uint32_t m_lcg_state = 1;
     int m_timeout = 0;
 
@@ -305,9 +1103,22 @@ private:
 
     float m_increment = 0.f;
     float m_phase = 0.f;
+    float m_segment_phase = 0.f;
+    int m_segment_position = 0;
     float m_frequency = 10.f;
     float m_amplitude;
 
+    bool m_exact = false;
+    bool m_resync = true;
+    float m_sin = 0.f;
+    float m_cos = 1.f;
+    float m_step_one_minus_cos = 0.f;
+    float m_step_sin = 0.f;
+    int m_renormalize_timeout = 0;
+
+    static constexpr int k_renormalize_period = 1024;
+    static constexpr float k_pi = twopi * 0.5f;
+
     static constexpr float k_min_frequency = 1.0f;
     static constexpr float k_max_frequency = 50.0f;
     static constexpr float k_max_depth = 5e-3f;
@@ -316,34 +1127,33 @@ private:
         m_amplitude = m_depth * k_max_depth / m_frequency;
     }
 
-public:
-    static constexpr float k_max_amplitude = k_max_depth / k_min_frequency;
-};
-
-class DCBlocker {
-public:
-    DCBlocker(
-        float sample_rate
-    ) :
-    m_sample_rate(sample_rate)
-    {
-    }
-
-    float process(float in) {
-        float x = in;
-        float y = x - m_x1 + m_k * m_y1;
-        float out = y;
-        m_x1 = x;
-        m_y1 = y;
-        return out;
+    void start_segment(void) {
+        m_timeout = run_lcg() * 0.1f / m_frequency * m_sample_rate / 48000.0f;
+        m_increment = (run_lcg() * (1.0f / 32767.0f) - 0.5f) * m_frequency / m_sample_rate;
+        // Rotating by cos/sin of the increment would lose most of the
+        // precision of the cosine, which is very close to 1. Instead use
+        // 1 - cos, computed accurately as 2 sin^2(increment / 2).
+        float half_sin = sinf(m_increment * 0.5f);
+        m_step_one_minus_cos = 2.0f * half_sin * half_sin;
+        m_step_sin = sinf(m_increment);
+        // Start each segment of the random walk from the exact phase.
+        m_resync = true;
+
+        // The phase is computed from the start of the segment rather than
+        // accumulated, which would round every increment in the same
+        // direction. The random walk can also wander arbitrarily far, so keep
+        // the phase small to preserve its precision.
+        m_segment_phase = m_phase;
+        if (m_segment_phase > k_pi) {
+            m_segment_phase -= twopi;
+        } else if (m_segment_phase < -k_pi) {
+            m_segment_phase += twopi;
+        }
+        m_segment_position = 0;
     }
 
-private:
-    const float m_sample_rate;
-
-    float m_x1 = 0.0f;
-    float m_y1 = 0.0f;
-    float m_k = 0.99f;
+public:
+    static constexpr float k_max_amplitude = k_max_depth / k_min_frequency;
 };
 
 class HiShelf {
@@ -371,7 +1181,10 @@ public:
     }
 
 private:
-    const float m_sample_dur;
+    template <class, class, class> friend class NHHall;
+    template <int, class> friend class NHHallBank;
+
+    float m_sample_dur;
     float m_s = 0.f;
     float m_g = 1;
     float m_gain = 1;
@@ -402,501 +1215,3651 @@ public:
     }
 
 private:
-    const float m_sample_dur;
+    template <class, class, class> friend class NHHall;
+    template <int, class> friend class NHHallBank;
+
+    float m_sample_dur;
     float m_s = 0.f;
     float m_g = 1;
     float m_gain = 1;
 };
 
-class BaseDelay {
+// Stereo half-band lowpass for resampling by 2, as two chains of first-order
+// allpasses in z^2 whose outputs are summed (a polyphase IIR half-band). Both
+// chains run at the lower rate, so decimating or interpolating costs a few
+// multiplies per sample. The coefficients give a flat passband up to 0.2 and
+// 80 dB of rejection from 0.3 of the higher sample rate.
+//
+// The Float4 lanes are chain 0 and chain 1 of the left channel, then of the
+// right. The state is flushed of denormals once per call rather than on every
+// sample, which keeps the flush out of the recursion.
+class HalfbandFilter {
 public:
-    int m_size;
-    float* m_buffer = nullptr;
+    // n stereo pairs in, n samples out. May run in place.
+    void decimate(const float* left, const float* right, float* out_left, float* out_right, int n) {
+        Float4 x1[k_stages];
+        Float4 y1[k_stages];
+        load_state(x1, y1);
+        for (int i = 0; i < n; i++) {
+            Float4 x(left[2 * i + 1], left[2 * i], right[2 * i + 1], right[2 * i]);
+            float y[4];
+            process(x, x1, y1).store(y);
+            out_left[i] = 0.5f * (y[0] + y[1]);
+            out_right[i] = 0.5f * (y[2] + y[3]);
+        }
+        store_state(x1, y1);
+    }
 
-    BaseDelay(
-        float sample_rate,
-        float max_delay,
-        float delay
-    ) :
-    m_sample_rate(sample_rate)
-    {
-        int max_delay_in_samples = m_sample_rate * max_delay;
-        m_size = next_power_of_two(max_delay_in_samples);
-        m_mask = m_size - 1;
+    void reset(void) {
+        memset(m_x1, 0, sizeof(m_x1));
+        memset(m_y1, 0, sizeof(m_y1));
+    }
 
-        m_read_position = 0;
+    // n samples in, 2n out.
+    void interpolate(const float* left, const float* right, float* out_left, float* out_right, int n) {
+        Float4 x1[k_stages];
+        Float4 y1[k_stages];
+        load_state(x1, y1);
+        for (int i = 0; i < n; i++) {
+            Float4 x(left[i], left[i], right[i], right[i]);
+            float y[4];
+            process(x, x1, y1).store(y);
+            out_left[2 * i] = y[0];
+            out_left[2 * i + 1] = y[1];
+            out_right[2 * i] = y[2];
+            out_right[2 * i + 1] = y[3];
+        }
+        store_state(x1, y1);
+    }
 
-        m_delay = delay;
-        m_delay_in_samples = m_sample_rate * delay;
+private:
+    // Sections per chain.
+    static constexpr int k_stages = 3;
+
+    float m_x1[k_stages][4] = {};
+    float m_y1[k_stages][4] = {};
+
+    static inline Float4 process(Float4 x, Float4* x1, Float4* y1) {
+        static const float coefficients[k_stages][4] = {
+            {0.060297391f, 0.215971445f, 0.060297391f, 0.215971445f},
+            {0.412590720f, 0.604358626f, 0.412590720f, 0.604358626f},
+            {0.772715654f, 0.923886139f, 0.772715654f, 0.923886139f}
+        };
+        for (int s = 0; s < k_stages; s++) {
+            Float4 y = Float4::load(coefficients[s]) * (x - y1[s]) + x1[s];
+            x1[s] = x;
+            y1[s] = y;
+            x = y;
+        }
+        return x;
     }
 
-protected:
-    const float m_sample_rate;
-    int m_mask;
-    int m_read_position;
-    float m_delay;
-    int m_delay_in_samples;
+    inline void load_state(Float4* x1, Float4* y1) const {
+        for (int s = 0; s < k_stages; s++) {
+            x1[s] = Float4::load(m_x1[s]);
+            y1[s] = Float4::load(m_y1[s]);
+        }
+    }
+
+    inline void store_state(const Float4* x1, const Float4* y1) {
+        for (int s = 0; s < k_stages; s++) {
+            flush_denormals(x1[s]).store(m_x1[s]);
+            flush_denormals(y1[s]).store(m_y1[s]);
+        }
+    }
 };
 
-// Fixed delay line.
-class Delay : public BaseDelay {
+// Stereo lowpass keeping one in every factor samples, for a factor of 2 or 4.
+// A factor of 4 is two half-band stages.
+class Decimator {
 public:
-    Delay(
-        float sample_rate,
-        float delay
+    Decimator(
+        int factor
     ) :
-    BaseDelay(sample_rate, delay, delay)
+    m_factor(factor)
     {
     }
 
-    float process(float in) {
-        float out_value = m_buffer[(m_read_position - m_delay_in_samples) & m_mask];
-        m_buffer[m_read_position] = in;
-        m_read_position = (m_read_position + 1) & m_mask;
-        float out = out_value;
-        return out;
+    // Returns the number of samples written to each output, one for every
+    // factor samples of input so far.
+    int process(const float* in_left, const float* in_right, float* out_left, float* out_right, int n) {
+        int written = 0;
+        while (n > 0) {
+            int take = std::min(n, k_block_size - m_count);
+            for (int i = 0; i < take; i++) {
+                m_left[m_count + i] = in_left[i];
+                m_right[m_count + i] = in_right[i];
+            }
+            m_count += take;
+            in_left += take;
+            in_right += take;
+            n -= take;
+
+            int m = m_count / m_factor;
+            if (m_factor == 4) {
+                m_stages[0].decimate(m_left, m_right, m_left, m_right, 2 * m);
+                m_stages[1].decimate(m_left, m_right, out_left + written, out_right + written, m);
+            } else {
+                m_stages[0].decimate(m_left, m_right, out_left + written, out_right + written, m);
+            }
+            written += m;
+
+            // Keep the samples that don't make up a whole output yet.
+            int used = m * m_factor;
+            for (int i = used; i < m_count; i++) {
+                m_left[i - used] = m_left[i];
+                m_right[i - used] = m_right[i];
+            }
+            m_count -= used;
+        }
+        return written;
     }
 
-    float tap(float delay) {
-        int delay_in_samples = delay * m_sample_rate;
-        int position = m_read_position - 1 - delay_in_samples;
-        float out = m_buffer[position & m_mask];
-        return out;
+    // Drop any input waiting for a whole output and silence the filters.
+    // Reset the Interpolator on the other side along with it.
+    void reset(void) {
+        m_count = 0;
+        m_stages[0].reset();
+        m_stages[1].reset();
     }
+
+private:
+    static constexpr int k_block_size = 64;
+
+    int m_factor;
+    int m_count = 0;
+    float m_left[k_block_size];
+    float m_right[k_block_size];
+    HalfbandFilter m_stages[2];
 };
 
-// Fixed Schroeder allpass.
-class Allpass : public BaseDelay {
+// Stereo counterpart of Decimator, raising the sample rate by its factor.
+class Interpolator {
 public:
-    float m_k = 0.5;
-
-    Allpass(
-        float sample_rate,
-        float delay,
-        float diffusion_sign
+    Interpolator(
+        int factor
     ) :
-    BaseDelay(sample_rate, delay, delay),
-    m_diffusion_sign(diffusion_sign)
+    m_factor(factor),
+    // Matching the Decimator's phase: until it has produced a sample, there
+    // are factor outputs to give.
+    m_pending_count(factor)
     {
     }
 
-    void set_diffusion(float diffusion) {
-        m_k = diffusion * m_diffusion_sign;
-    }
-
-    float process(float in) {
-        float delayed_signal = m_buffer[(m_read_position - m_delay_in_samples) & m_mask];
+    // Take in m samples per channel and write n. Outputs left over go out
+    // first on the next call. This works out as long as m counts the samples
+    // a Decimator produced from the same n.
+    void process(
+        const float* in_left,
+        const float* in_right,
+        int m,
+        float* out_left,
+        float* out_right,
+        int n
+    ) {
+        int written = std::min(m_pending_count, n);
+        for (int i = 0; i < written; i++) {
+            out_left[i] = m_pending_left[i];
+            out_right[i] = m_pending_right[i];
+        }
+        for (int i = written; i < m_pending_count; i++) {
+            m_pending_left[i - written] = m_pending_left[i];
+            m_pending_right[i - written] = m_pending_right[i];
+        }
+        m_pending_count -= written;
+
+        while (m > 0) {
+            float left[k_block_size];
+            float right[k_block_size];
+            int take = std::min(m, k_block_size / m_factor);
+            if (m_factor == 4) {
+                float mid_left[k_block_size / 2];
+                float mid_right[k_block_size / 2];
+                m_stages[1].interpolate(in_left, in_right, mid_left, mid_right, take);
+                m_stages[0].interpolate(mid_left, mid_right, left, right, 2 * take);
+            } else {
+                m_stages[0].interpolate(in_left, in_right, left, right, take);
+            }
+            in_left += take;
+            in_right += take;
+            m -= take;
+
+            for (int i = 0; i < take * m_factor; i++) {
+                if (written < n) {
+                    out_left[written] = left[i];
+                    out_right[written] = right[i];
+                    written++;
+                } else {
+                    m_pending_left[m_pending_count] = left[i];
+                    m_pending_right[m_pending_count] = right[i];
+                    m_pending_count++;
+                }
+            }
+        }
+    }
+
+    // Back to factor silent outputs ahead of a freshly reset Decimator.
+    void reset(void) {
+        m_pending_count = m_factor;
+        memset(m_pending_left, 0, sizeof(m_pending_left));
+        memset(m_pending_right, 0, sizeof(m_pending_right));
+        m_stages[0].reset();
+        m_stages[1].reset();
+    }
+
+private:
+    static constexpr int k_block_size = 64;
+
+    int m_factor;
+    int m_pending_count;
+    float m_pending_left[4] = {};
+    float m_pending_right[4] = {};
+    HalfbandFilter m_stages[2];
+};
+
+// How delay buffers are sized. Power-of-two buffers waste up to half their
+// memory, but wrap around with a mask. Exact buffers are as long as the delay
+// needs and no longer, and wrap around with a compare and add, which is
+// slower. The mode is chosen at run time: the block and late loops are
+// compiled once per mode and picked once per call, while the single-sample
+// methods of the delay units check it on every wrap.
+enum class BufferMode {
+    power_of_two,
+    exact
+};
+
+// The rate the late network runs at, as a fraction of the sample rate. At half
+// or quarter rate ("eco" mode), the late delays are shorter in samples and
+// their input and output are resampled, which loses the top of the tail.
+enum class LateRate {
+    full = 1,
+    half = 2,
+    quarter = 4
+};
+
+// Wraparound of buffer indices that are at most one buffer length out of
+// range, one policy per BufferMode. The block processing loops are templates
+// on these, so that each mode gets its own loop.
+class PowerOfTwoWrap {
+public:
+    PowerOfTwoWrap() { }
+    explicit PowerOfTwoWrap(int size) : m_mask(size - 1) { }
+
+    // Wrap an index in [-size, size).
+    inline int wrap(int index) const {
+        return index & m_mask;
+    }
+
+    // Wrap an index in [0, 2 * size).
+    inline int wrap_above(int index) const {
+        return index & m_mask;
+    }
+
+private:
+    int m_mask;
+};
+
+class ExactWrap {
+public:
+    ExactWrap() { }
+    explicit ExactWrap(int size) : m_size(size) { }
+
+    inline int wrap(int index) const {
+        return index + (-(index < 0) & m_size);
+    }
+
+    inline int wrap_above(int index) const {
+        return wrap(index - m_size);
+    }
+
+private:
+    int m_size;
+};
+
+// Delay line storage policies. The reverb always computes in float, and
+// converts samples on every read from and write to a delay buffer.
+// FloatStorage keeps them as they are. HalfStorage and Int16Storage halve the
+// memory of every delay line at the cost of a noise floor, which test/rt60
+// measures, and of the conversions, which test/benchmark measures.
+class FloatStorage {
+public:
+    typedef float Sample;
+
+    static inline float load(Sample x) {
+        return x;
+    }
+
+    static inline Sample store(float x) {
+        return x;
+    }
+};
+
+// IEEE 754 half precision. The 11-bit mantissa puts the noise about 66 dB
+// below the signal at any level, and the range goes up to 65504.
+class HalfStorage {
+public:
+    typedef uint16_t Sample;
+
+    static inline float load(Sample x) {
+#if defined(NH_UGENS_F16C)
+        return _cvtsh_ss(x);
+#else
+        // Move the exponent and mantissa into place and rebias the exponent.
+        const uint32_t shifted_exponent = 0x7c00u << 13;
+        uint32_t bits = static_cast<uint32_t>(x & 0x7fff) << 13;
+        uint32_t exponent = bits & shifted_exponent;
+        bits += (127 - 15) << 23;
+        if (exponent == shifted_exponent) {
+            // Infinity or NaN.
+            bits += (128 - 16) << 23;
+        } else if (exponent == 0) {
+            // Zero or subnormal, renormalized by the subtraction.
+            bits += 1 << 23;
+            bits = float_to_bits(bits_to_float(bits) - bits_to_float(113u << 23));
+        }
+        bits |= static_cast<uint32_t>(x & 0x8000) << 16;
+        return bits_to_float(bits);
+#endif
+    }
+
+    static inline Sample store(float x) {
+#if defined(NH_UGENS_F16C)
+        return _cvtss_sh(x, 0);
+#else
+        // Round to nearest even, like the hardware conversion.
+        uint32_t bits = float_to_bits(x);
+        uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+        uint32_t result;
+        if (bits >= (127u + 16) << 23) {
+            // Too large: infinity, or a quiet NaN for NaN.
+            result = bits > (255u << 23) ? 0x7e00 : 0x7c00;
+        } else if (bits < (113u << 23)) {
+            // Subnormal or zero. Adding a magic number makes the FPU round
+            // the mantissa into place.
+            const uint32_t magic = ((127 - 15) + (23 - 10) + 1) << 23;
+            result = float_to_bits(bits_to_float(bits) + bits_to_float(magic)) - magic;
+        } else {
+            uint32_t mantissa_odd = (bits >> 13) & 1;
+            bits -= (127 - 15) << 23;
+            bits += 0xfff + mantissa_odd;
+            result = bits >> 13;
+        }
+        return static_cast<Sample>(result | (sign >> 16));
+#endif
+    }
+
+private:
+    static inline uint32_t float_to_bits(float x) {
+        uint32_t result;
+        memcpy(&result, &x, sizeof(result));
+        return result;
+    }
+
+    static inline float bits_to_float(uint32_t x) {
+        float result;
+        memcpy(&result, &x, sizeof(result));
+        return result;
+    }
+};
+
+// 16-bit fixed point. Delay line signals run hotter than the input -- past 10
+// for full scale white noise and a long RT60 -- so full scale is k_full_scale
+// rather than 1, and anything louder is clipped. The noise floor is fixed
+// rather than relative to the signal, and rounding in the feedback loops can
+// leave a low level limit cycle in place of the end of the tail.
+class Int16Storage {
+public:
+    typedef int16_t Sample;
+
+    static constexpr float k_full_scale = 8.0f;
+
+    static inline float load(Sample x) {
+        return x * (k_full_scale / 32767.0f);
+    }
+
+    static inline Sample store(float x) {
+        x *= 32767.0f / k_full_scale;
+        x = std::max(std::min(x, 32767.0f), -32767.0f);
+        // Round to nearest by pushing the fraction out of the mantissa; the
+        // cast alone would truncate.
+        const float magic = 12582912.0f;
+        x = (x + magic) - magic;
+        return static_cast<Sample>(x);
+    }
+};
+
+template <class Storage = FloatStorage>
+class BaseDelay {
+public:
+    typedef typename Storage::Sample Sample;
+
+    int m_size;
+    Sample* m_buffer = nullptr;
+
+    BaseDelay(
+        float sample_rate,
+        float max_delay,
+        float delay,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) :
+    m_sample_rate(sample_rate)
+    {
+        int max_delay_in_samples = m_sample_rate * max_delay;
+        m_buffer_mode = buffer_mode;
+        if (buffer_mode == BufferMode::exact) {
+            m_size = std::max(max_delay_in_samples, 1);
+        } else {
+            m_size = next_power_of_two(max_delay_in_samples);
+        }
+
+        m_read_position = 0;
+
+        m_delay = delay;
+        m_delay_in_samples = m_sample_rate * delay;
+    }
+
+    int get_delay_in_samples(void) const {
+        return m_delay_in_samples;
+    }
+
+    BufferMode get_buffer_mode(void) const {
+        return m_buffer_mode;
+    }
+
+    // Zero the samples written since the last reset, which are the m_dirty
+    // samples before the write position, wrapping around. The write position
+    // goes back to the start too, so the fractional read positions round as
+    // they did the first time.
+    void reset(void) {
+        int start = m_read_position - m_dirty;
+        if (start < 0) {
+            memset(m_buffer + start + m_size, 0, sizeof(Sample) * -start);
+            start = 0;
+        }
+        memset(m_buffer + start, 0, sizeof(Sample) * (m_read_position - start));
+        m_dirty = 0;
+        m_read_position = 0;
+    }
+
+protected:
+    template <class, class, class> friend class NHHall;
+    template <int, class> friend class NHHallBank;
+    template <int> friend class BankDelay;
+
+    float m_sample_rate;
+    BufferMode m_buffer_mode;
+    int m_read_position;
+    float m_delay;
+    int m_delay_in_samples;
+    // How many samples have been written since the buffer was last zeroed,
+    // up to its size.
+    int m_dirty = 0;
+
+    inline void mark_written(int n) {
+        m_dirty = std::min(m_dirty + n, m_size);
+    }
+
+    // For the single-sample methods, checking the mode every time. See
+    // PowerOfTwoWrap and ExactWrap.
+    inline int wrap(int index) const {
+        if (m_buffer_mode == BufferMode::exact) {
+            return ExactWrap(m_size).wrap(index);
+        }
+        return PowerOfTwoWrap(m_size).wrap(index);
+    }
+
+    inline int wrap_above(int index) const {
+        if (m_buffer_mode == BufferMode::exact) {
+            return ExactWrap(m_size).wrap_above(index);
+        }
+        return PowerOfTwoWrap(m_size).wrap_above(index);
+    }
+
+    inline float read(int index) const {
+        return Storage::load(m_buffer[index]);
+    }
+
+    inline void write(int index, float x) {
+        m_buffer[index] = Storage::store(x);
+    }
+};
+
+// Fixed delay line.
+template <class Storage = FloatStorage>
+class Delay : public BaseDelay<Storage> {
+public:
+    typedef typename Storage::Sample Sample;
+
+    Delay(
+        float sample_rate,
+        float delay,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) :
+    BaseDelay<Storage>(sample_rate, delay, delay, buffer_mode)
+    {
+    }
+
+    float process(float in) {
+        float out_value = this->read(this->wrap(this->m_read_position - this->m_delay_in_samples));
+        this->write(this->m_read_position, in);
+        this->m_read_position = this->wrap_above(this->m_read_position + 1);
+        this->mark_written(1);
+        float out = out_value;
+        return out;
+    }
+
+    float tap(float delay) {
+        int delay_in_samples = delay * this->m_sample_rate;
+        int position = this->m_read_position - 1 - delay_in_samples;
+        float out = this->read(this->wrap(position));
+        return out;
+    }
+
+    void process(const float* in, float* out, int n) {
+        // Single samples, as from NHHall::process, aren't worth setting up
+        // the runs for.
+        if (n == 1) {
+            out[0] = process(in[0]);
+        } else if (this->m_buffer_mode == BufferMode::exact) {
+            process_wrapped(in, out, n, ExactWrap(this->m_size));
+        } else {
+            process_wrapped(in, out, n, PowerOfTwoWrap(this->m_size));
+        }
+    }
+
+    // Block version of tap() for the n most recently written samples: out[i]
+    // is what tap() would have returned just before the i-th of them was
+    // written.
+    void tap(float* out, int n, float delay) {
+        tap_samples(out, n, delay * this->m_sample_rate);
+    }
+
+    // The same with the delay already in samples.
+    void tap_samples(float* out, int n, int delay_in_samples) {
+        if (n == 1) {
+            out[0] = this->read(this->wrap(this->m_read_position - 2 - delay_in_samples));
+        } else if (this->m_buffer_mode == BufferMode::exact) {
+            tap_wrapped(out, n, delay_in_samples, ExactWrap(this->m_size));
+        } else {
+            tap_wrapped(out, n, delay_in_samples, PowerOfTwoWrap(this->m_size));
+        }
+    }
+
+private:
+    // The block loops are split into runs in which neither the read nor the
+    // write position wraps around, so that only the runs need wrapping.
+    template <class Wrap>
+    void process_wrapped(const float* in, float* out, int n, Wrap wrap) {
+        this->mark_written(n);
+        Sample* buffer = this->m_buffer;
+        const int size = this->m_size;
+        int write_position = this->m_read_position;
+        int read_position = wrap.wrap(write_position - this->m_delay_in_samples);
+        while (n > 0) {
+            int run = std::min(n, size - std::max(write_position, read_position));
+            for (int i = 0; i < run; i++) {
+                float out_value = Storage::load(buffer[read_position + i]);
+                buffer[write_position + i] = Storage::store(in[i]);
+                out[i] = out_value;
+            }
+            write_position = wrap.wrap_above(write_position + run);
+            read_position = wrap.wrap_above(read_position + run);
+            in += run;
+            out += run;
+            n -= run;
+        }
+        this->m_read_position = write_position;
+    }
+
+    template <class Wrap>
+    void tap_wrapped(float* out, int n, int delay_in_samples, Wrap wrap) {
+        const Sample* buffer = this->m_buffer;
+        const int size = this->m_size;
+        int position = wrap.wrap(this->m_read_position - n - 1 - delay_in_samples);
+        while (n > 0) {
+            int run = std::min(n, size - position);
+            for (int i = 0; i < run; i++) {
+                out[i] = Storage::load(buffer[position + i]);
+            }
+            position = wrap.wrap_above(position + run);
+            out += run;
+            n -= run;
+        }
+    }
+};
+
+// Fixed Schroeder allpass.
+template <class Storage = FloatStorage>
+class Allpass : public BaseDelay<Storage> {
+public:
+    typedef typename Storage::Sample Sample;
+
+    float m_k = 0.5;
+
+    Allpass(
+        float sample_rate,
+        float delay,
+        float diffusion_sign,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) :
+    BaseDelay<Storage>(sample_rate, delay, delay, buffer_mode),
+    m_diffusion_sign(diffusion_sign)
+    {
+    }
+
+    void set_diffusion(float diffusion) {
+        m_k = diffusion * m_diffusion_sign;
+    }
+
+    float process(float in) {
+        float delayed_signal = this->read(this->wrap(this->m_read_position - this->m_delay_in_samples));
         float feedback_plus_input = in + delayed_signal * m_k;
-        m_buffer[m_read_position] = flush_denormals(feedback_plus_input);
-        m_read_position = (m_read_position + 1) & m_mask;
+        this->write(this->m_read_position, flush_denormals(feedback_plus_input));
+        this->m_read_position = this->wrap_above(this->m_read_position + 1);
+        this->mark_written(1);
         float out = feedback_plus_input * -m_k + delayed_signal;
         return out;
     }
 
+    void process(const float* in, float* out, int n) {
+        // See Delay::process.
+        if (n == 1) {
+            out[0] = process(in[0]);
+        } else if (this->m_buffer_mode == BufferMode::exact) {
+            process_wrapped(in, out, n, ExactWrap(this->m_size));
+        } else {
+            process_wrapped(in, out, n, PowerOfTwoWrap(this->m_size));
+        }
+    }
+
+    // The same, adding k_step to m_k after each sample.
+    void process(const float* in, float* out, int n, float k_step) {
+        for (int i = 0; i < n; i++) {
+            out[i] = process(in[i]);
+            m_k += k_step;
+        }
+    }
+
 private:
+    // See Delay::process_wrapped.
+    template <class Wrap>
+    void process_wrapped(const float* in, float* out, int n, Wrap wrap) {
+        this->mark_written(n);
+        Sample* buffer = this->m_buffer;
+        const int size = this->m_size;
+        const float k = m_k;
+        int write_position = this->m_read_position;
+        int read_position = wrap.wrap(write_position - this->m_delay_in_samples);
+        while (n > 0) {
+            int run = std::min(n, size - std::max(write_position, read_position));
+            for (int i = 0; i < run; i++) {
+                float delayed_signal = Storage::load(buffer[read_position + i]);
+                float feedback_plus_input = in[i] + delayed_signal * k;
+                buffer[write_position + i] = Storage::store(flush_denormals(feedback_plus_input));
+                out[i] = feedback_plus_input * -k + delayed_signal;
+            }
+            write_position = wrap.wrap_above(write_position + run);
+            read_position = wrap.wrap_above(read_position + run);
+            in += run;
+            out += run;
+            n -= run;
+        }
+        this->m_read_position = write_position;
+    }
+
+    template <class, class, class> friend class NHHall;
+    template <int> friend class BankDelay;
+
     float m_diffusion_sign;
 };
 
-// Schroeder allpass with variable delay and cubic interpolation.
-class VariableAllpass : public BaseDelay {
+// Schroeder allpass with variable delay, interpolated by one of the policies
+// above.
+template <class Storage = FloatStorage, class Interpolation = CubicInterpolation>
+class VariableAllpass : public BaseDelay<Storage> {
 public:
     float m_k = 0.5;
+    float m_interpolation_state = 0.0f;
 
     VariableAllpass(
         float sample_rate,
         float delay,
         float max_mod_depth,
-        float diffusion_sign
+        float diffusion_sign,
+        BufferMode buffer_mode = BufferMode::power_of_two
     ) :
-    BaseDelay(sample_rate, delay + max_mod_depth + 4.0 / sample_rate, delay),
+    BaseDelay<Storage>(sample_rate, delay + max_mod_depth + 4.0 / sample_rate, delay, buffer_mode),
     m_diffusion_sign(diffusion_sign)
     {
     }
 
-    void set_diffusion(float diffusion) {
-        m_k = diffusion * m_diffusion_sign;
+    void set_diffusion(float diffusion) {
+        m_k = diffusion * m_diffusion_sign;
+    }
+
+    float process(float in, float offset) {
+        float position = this->m_read_position - (this->m_delay + offset) * this->m_sample_rate;
+
+        // This catches a very sneaky bug -- casting position to int rounds
+        // toward zero. To mitigate this, we ensure that the position is always
+        // above zero before rounding it down, using the fact that
+        // (m_delay + offset) * m_sample_rate < m_size.
+        position += this->m_size;
+
+        int iposition = position;
+        float position_frac = position - iposition;
+
+        // The taps are within [0, 2 * m_size), as the modulated delay is at
+        // least four samples shorter than the buffer.
+        float y[Interpolation::k_taps];
+        for (int t = 0; t < Interpolation::k_taps; t++) {
+            y[t] = this->read(this->wrap_above(iposition + Interpolation::k_first_tap + t));
+        }
+
+        float delayed_signal = Interpolation::interpolate(position_frac, y, m_interpolation_state);
+
+        float feedback_plus_input = in + delayed_signal * m_k;
+        this->write(this->m_read_position, flush_denormals(feedback_plus_input));
+        this->m_read_position = this->wrap_above(this->m_read_position + 1);
+        this->mark_written(1);
+        float out = feedback_plus_input * -m_k + delayed_signal;
+
+        return out;
+    }
+
+private:
+    template <class, class, class> friend class NHHall;
+    template <int> friend class BankDelay;
+
+    float m_diffusion_sign;
+};
+
+// The parameters that can be changed through NHHall::post_parameter and
+// ParameterEvent. The shelves take a frequency and a ratio, the others a
+// single value, as the setters of the same names.
+enum class Parameter : uint8_t {
+    rt60,
+    k,
+    stereo,
+    low_shelf,
+    hi_shelf,
+    early_diffusion,
+    late_diffusion,
+    mod_rate,
+    mod_depth,
+    predelay,
+    tilt,
+    dry_wet,
+    output_gain,
+    count
+};
+
+struct ParameterChange {
+    Parameter parameter;
+    float value;
+    float value2;
+};
+
+// A parameter change at a sample offset into a block, see
+// NHHall::process_block.
+struct ParameterEvent {
+    int offset;
+    ParameterChange change;
+};
+
+// Wait-free ring of parameter changes from one control thread to the audio
+// thread. push() and pop() may run concurrently, one thread each.
+class ParameterQueue {
+public:
+    static constexpr int k_capacity = 64;
+
+    ParameterQueue() { }
+
+    // Moving copies the pending changes, and must not race either thread.
+    ParameterQueue(ParameterQueue&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    ParameterQueue& operator=(ParameterQueue&& other) noexcept {
+        for (int i = 0; i < k_capacity; i++) {
+            m_changes[i] = other.m_changes[i];
+        }
+        m_read.store(other.m_read.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_write.store(other.m_write.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Producer side. Returns false, dropping the change, if the queue is full.
+    bool push(const ParameterChange& change) {
+        int write = m_write.load(std::memory_order_relaxed);
+        int next = (write + 1) & (k_capacity - 1);
+        if (next == m_read.load(std::memory_order_acquire)) {
+            return false;
+        }
+        m_changes[write] = change;
+        m_write.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(ParameterChange& change) {
+        int read = m_read.load(std::memory_order_relaxed);
+        if (read == m_write.load(std::memory_order_acquire)) {
+            return false;
+        }
+        change = m_changes[read];
+        m_read.store((read + 1) & (k_capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. A cheap check with no ordering: a change posted just
+    // now may be missed, and is then popped on the next call.
+    bool looks_empty(void) const {
+        return m_read.load(std::memory_order_relaxed) == m_write.load(std::memory_order_relaxed);
+    }
+
+private:
+    ParameterChange m_changes[k_capacity];
+    // The two indices are written by different threads, so they are kept
+    // on separate cache lines.
+    std::atomic<int> m_read {0};
+    char m_padding[64];
+    std::atomic<int> m_write {0};
+};
+
+template <
+    class Alloc = Allocator,
+    class Storage = FloatStorage,
+    class Interpolation = CubicInterpolation
+>
+class NHHall {
+public:
+    float m_k;
+    bool m_initialization_was_successful;
+
+    NHHall(
+        float sample_rate,
+        Alloc allocator,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) :
+    NHHall(sample_rate, std::move(allocator), buffer_mode, late_rate, max_predelay, nullptr, 0)
+    { }
+
+    // The allocator is moved out of the std::unique_ptr, which must not be
+    // empty.
+    NHHall(
+        float sample_rate,
+        std::unique_ptr<Alloc> allocator,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) :
+    NHHall(sample_rate, std::move(*allocator), buffer_mode, late_rate, max_predelay)
+    { }
+
+    // If no allocator object is passed in, we try to make one ourselves by
+    // calling the constructor with no arguments.
+    NHHall(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) :
+    NHHall(sample_rate, Alloc(), buffer_mode, late_rate, max_predelay)
+    { }
+
+    // Moving hands the delay lines over; the moved-from NHHall may only be
+    // destroyed or assigned to. This is noexcept if moving Alloc is.
+    // Copying would need a second slab, so it isn't allowed.
+    NHHall(NHHall&&) = default;
+    NHHall& operator=(NHHall&&) = default;
+    NHHall(const NHHall&) = delete;
+    NHHall& operator=(const NHHall&) = delete;
+
+    // Construct an NHHall together with its delay lines in memory_size bytes
+    // at memory, which the caller owns and must keep until it has called
+    // ~NHHall() on the result. No allocation happens. Returns nullptr if the
+    // memory is too small, and otherwise the NHHall, which is at the start of
+    // the memory give or take its alignment.
+    static NHHall* create_in_place(
+        void* memory,
+        int memory_size,
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f,
+        Alloc allocator = Alloc()
+    ) {
+        uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+        uintptr_t aligned = (address + alignof(NHHall) - 1) & ~static_cast<uintptr_t>(alignof(NHHall) - 1);
+        int offset = static_cast<int>(aligned - address) + static_cast<int>(sizeof(NHHall));
+        if (memory == nullptr || memory_size < offset + required_bytes(sample_rate, buffer_mode, late_rate, max_predelay)) {
+            return nullptr;
+        }
+        char* slab = static_cast<char*>(memory) + offset;
+        return new (reinterpret_cast<void*>(aligned)) NHHall(
+            sample_rate, std::move(allocator), buffer_mode, late_rate, max_predelay, slab, memory_size - offset
+        );
+    }
+
+    // The memory create_in_place() needs, including the worst-case alignment
+    // slack for the object.
+    static constexpr int required_bytes_in_place(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) {
+        return alignof(NHHall) - 1 + sizeof(NHHall) + required_bytes(sample_rate, buffer_mode, late_rate, max_predelay);
+    }
+
+    // The number of bytes the constructor will request from the allocator at
+    // this sample rate, in a single allocate() call.
+    static constexpr int required_bytes(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) {
+        return get_required_bytes(sample_rate, 1, buffer_mode, late_rate)
+            + 2 * get_slab_stride(
+                sizeof(typename Storage::Sample) * get_buffer_size(sample_rate, max_predelay, buffer_mode)
+            );
+    }
+
+    inline float compute_k_from_rt60(float rt60) {
+        return powf(0.001f, k_average_delay_time / rt60);
+    }
+
+    inline void set_rt60(float rt60) {
+        float k = compute_k_from_rt60(rt60);
+        m_rt60 = rt60;
+        m_rt60_k = k;
+        set_k(k);
+    }
+
+    // With smoothing on, m_k must be changed through here rather than
+    // directly, see set_smoothing_time.
+    inline void set_k(float k) {
+        m_target.k = k;
+        if (m_smoothing_samples == 0) {
+            m_k = k;
+        } else {
+            start_ramp();
+        }
+    }
+
+    inline void set_stereo(float stereo) {
+        m_stereo = stereo;
+        float angle = stereo * twopi * 0.25f;
+        m_target.rotate_cos = cosf(angle);
+        m_target.rotate_sin = sinf(angle);
+        if (m_smoothing_samples == 0) {
+            m_rotate_cos = m_target.rotate_cos;
+            m_rotate_sin = m_target.rotate_sin;
+        } else {
+            start_ramp();
+        }
+    }
+
+    // The shelf gains depend on m_k, so the shelves are worked out at the
+    // start of the next block, and again whenever m_k changes. See
+    // update_shelves.
+    inline void set_low_shelf_parameters(float frequency, float ratio) {
+        m_low_shelf_frequency = frequency;
+        m_low_shelf_ratio = ratio;
+        m_shelves_dirty = true;
+    }
+
+    inline void set_hi_shelf_parameters(float frequency, float ratio) {
+        m_hi_shelf_frequency = frequency;
+        m_hi_shelf_ratio = ratio;
+        m_shelves_dirty = true;
+    }
+
+    // Remove DC from the late branches. Off by default, since the shelves
+    // already let it decay whenever m_k is below 1.
+    inline void set_dc_blocker(bool dc_blocker) {
+        if (dc_blocker && !m_dc_blocker) {
+            for (int j = 0; j < 4; j++) {
+                m_dc_blocker_x1[j] = 0.0f;
+                m_dc_blocker_y1[j] = 0.0f;
+            }
+        }
+        m_dc_blocker = dc_blocker;
+    }
+
+    inline void set_early_diffusion(float diffusion) {
+        for (int j = 0; j < 8; j++) {
+            m_target.early_allpass_k[j] = diffusion * m_early_allpasses[j].m_diffusion_sign;
+        }
+        if (m_smoothing_samples == 0) {
+            for (auto& x : m_early_allpasses) {
+                x.set_diffusion(diffusion);
+            }
+        } else {
+            start_ramp();
+        }
+    }
+
+    inline void set_late_diffusion(float diffusion) {
+        for (int j = 0; j < 4; j++) {
+            m_target.variable_allpass_k[j] = diffusion * m_late_variable_allpasses[j].m_diffusion_sign;
+            m_target.allpass_k[j] = diffusion * m_late_allpasses[j].m_diffusion_sign;
+        }
+        if (m_smoothing_samples == 0) {
+            for (auto& x : m_late_allpasses) {
+                x.set_diffusion(diffusion);
+            }
+            for (auto& x : m_late_variable_allpasses) {
+                x.set_diffusion(diffusion);
+            }
+        } else {
+            start_ramp();
+        }
+    }
+
+    inline void set_mod_rate(float mod_rate) {
+        m_lfo.set_rate(mod_rate);
+    }
+
+    // A depth of 0 moves the modulated allpasses onto fixed integer delays,
+    // and stops running the LFO. See process_late.
+    inline void set_mod_depth(float mod_depth) {
+        m_lfo.set_depth(mod_depth);
+        float target = mod_depth > 0.0f ? 0.0f : 1.0f;
+        if (target < m_unmodulated_target) {
+            // The control-rate ramp went stale while the LFO was stopped.
+            m_mod_control_restart = true;
+        }
+        m_unmodulated_target = target;
+    }
+
+    inline void set_exact_lfo(bool exact) {
+        m_lfo.set_exact(exact);
+    }
+
+    inline void set_mod_control_period(int period) {
+        m_mod_control_period = std::max(period, 1);
+        m_mod_control_timeout = 0;
+        m_mod_control_restart = true;
+    }
+
+    inline void seed(uint32_t seed) {
+        m_lfo.seed(seed);
+    }
+
+    // See process_chunk.
+    inline void set_auto_sleep(bool auto_sleep) {
+        m_auto_sleep = auto_sleep;
+        if (!auto_sleep) {
+            m_sleeping = false;
+        }
+    }
+
+    inline void set_sleep_threshold(float threshold_db) {
+        m_sleep_threshold = powf(10.0f, threshold_db * 0.1f);
+    }
+
+    // Delay the input of the reverb by this many seconds, up to the
+    // max_predelay it was constructed with. This isn't smoothed.
+    inline void set_predelay(float seconds) {
+        float predelay = std::min(std::max(seconds, 0.0f), m_max_predelay);
+        int samples = std::min(static_cast<int>(predelay * m_sample_rate), m_predelays[0].m_size);
+        if (samples > 0 && m_predelay_samples == 0) {
+            // The lines stop while the predelay is off, and hold stale input.
+            for (auto& x : m_predelays) {
+                x.reset();
+            }
+        }
+        m_predelay_samples = samples;
+        for (auto& x : m_predelays) {
+            x.m_delay_in_samples = samples;
+        }
+        m_output_stage = true;
+    }
+
+    // Tilt the wet signal about frequency, raising the treble and lowering
+    // the bass by db / 2 each. Negative db darken it.
+    inline void set_tilt(float frequency, float db) {
+        m_tilt_frequency = frequency;
+        m_tilt_db = db;
+        update_output_stage();
+    }
+
+    // Linear gains of the input and the reverb in the output. The defaults
+    // are 0 and 1, only the wet signal.
+    inline void set_dry_wet(float dry, float wet) {
+        m_dry = dry;
+        m_wet = wet;
+        update_output_stage();
+    }
+
+    // Linear gain of the whole output, dry and wet.
+    inline void set_output_gain(float gain) {
+        m_output_gain = gain;
+        update_output_stage();
+    }
+
+    // Ramp m_k, the rotation, the diffusions and the shelves linearly to new
+    // settings over this many seconds. 0, the default, switches at once. See
+    // process_chunk_ramped.
+    inline void set_smoothing_time(float seconds) {
+        int samples = static_cast<int>(std::max(seconds, 0.0f) * m_sample_rate);
+        if (samples == 0) {
+            snap_to_target();
+        } else if (m_smoothing_samples == 0) {
+            // The targets went unused, and m_k may have been set directly.
+            m_target = get_coefficients();
+        }
+        m_smoothing_samples = samples;
+    }
+
+    // Queue a parameter change from another thread, to take effect at the
+    // start of the next block. This is the only method that may be called
+    // while the reverb is processing. Changes of the same parameter within
+    // a block collapse into the last one, and one that doesn't change the
+    // value costs nothing. Returns false if the queue is full.
+    inline bool post_parameter(Parameter parameter, float value, float value2 = 0.0f) {
+        ParameterChange change = {parameter, value, value2};
+        return m_parameter_queue.push(change);
+    }
+
+    // Return to the state of a freshly constructed NHHall, keeping all
+    // parameters. See clear_state.
+    void reset(void) {
+        clear_state();
+        for (auto& x : m_predelays) {
+            x.reset();
+        }
+        m_tilt_state[0] = 0.0f;
+        m_tilt_state[1] = 0.0f;
+        snap_to_target();
+        m_lfo.reset();
+        m_mod_control_timeout = 0;
+        m_mod_control_restart = true;
+        m_unmodulated_mix = m_unmodulated_target;
+        m_sleeping = false;
+        m_silent_input_samples = 0;
+        m_tail_power = 0.0f;
+    }
+
+    inline bool is_sleeping(void) const {
+        return m_sleeping;
+    }
+
+    // An upper estimate of how long the output will take to fall below the
+    // sleep threshold if the input is silent from now on, or the largest int
+    // if the tail never decays.
+    int tail_remaining_samples(void) const {
+        if (m_sleeping) {
+            return 0;
+        }
+        int hold = std::max(m_sleep_hold_samples - m_silent_input_samples, 0);
+        if (m_tail_power < m_sleep_threshold) {
+            return hold;
+        }
+        float decay = compute_tail_decay();
+        if (decay >= 1.0f) {
+            return std::numeric_limits<int>::max();
+        }
+        float samples = logf(m_sleep_threshold / m_tail_power) / logf(decay);
+        if (samples >= static_cast<float>(std::numeric_limits<int>::max())) {
+            return std::numeric_limits<int>::max();
+        }
+        return std::max(hold, static_cast<int>(samples) + 1);
+    }
+
+    Stereo process(Stereo in) {
+#if defined(NH_UGENS_HARDWARE_FTZ)
+        DenormalGuard denormal_guard;
+#endif
+        // SuperCollider and ChucK call this once per sample, so the block
+        // start and the chunk setup are skipped when there is nothing for
+        // them to do.
+        if (!block_start_is_idle()) {
+            begin_block();
+        }
+        Stereo out;
+        if (m_output_stage || m_auto_sleep) {
+            process_chunk_mixed(&in[0], &in[1], &out[0], &out[1], 1);
+        } else if (m_ramp_remaining > 0) {
+            process_chunk_awake(&in[0], &in[1], &out[0], &out[1], 1);
+        } else {
+            process_chunk_with<1>(&in[0], &in[1], &out[0], &out[1], 1, nullptr);
+        }
+        return out;
+    }
+
+    Stereo process(float in_left, float in_right) {
+        Stereo in = {{in_left, in_right}};
+        return process(in);
+    }
+
+    // Process a block of non-interleaved audio. The output pointers may be
+    // equal to the input pointers for in-place processing.
+    void process_block(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int frames
+    ) {
+#if defined(NH_UGENS_HARDWARE_FTZ)
+        DenormalGuard denormal_guard;
+#endif
+        begin_block();
+        process_span(in_left, in_right, out_left, out_right, frames);
+    }
+
+    // In-place variant of the above.
+    void process_block(float* left, float* right, int frames) {
+        process_block(left, right, left, right, frames);
+    }
+
+    // Process a block, applying each event just before the sample at its
+    // offset. The events must be sorted by offset. Those at the same offset
+    // are applied in order, and those at frames or later after the block.
+    // The block is split at the events, and the parts are processed as
+    // above, so the output is exactly that of calling the setters between
+    // process() calls.
+    void process_block(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int frames,
+        const ParameterEvent* events,
+        int event_count
+    ) {
+#if defined(NH_UGENS_HARDWARE_FTZ)
+        DenormalGuard denormal_guard;
+#endif
+        begin_block();
+        int position = 0;
+        int event = 0;
+        while (position < frames) {
+            if (event < event_count && events[event].offset <= position) {
+                while (event < event_count && events[event].offset <= position) {
+                    apply_parameter(events[event].change);
+                    event++;
+                }
+                update_shelves();
+            }
+            int end = event < event_count ? std::min(events[event].offset, frames) : frames;
+            process_span(
+                in_left + position,
+                in_right + position,
+                out_left + position,
+                out_right + position,
+                end - position
+            );
+            position = end;
+        }
+        for (; event < event_count; event++) {
+            apply_parameter(events[event].change);
+        }
+    }
+
+    // In-place variant of the above.
+    void process_block(
+        float* left, float* right, int frames, const ParameterEvent* events, int event_count
+    ) {
+        process_block(left, right, left, right, frames, events, event_count);
+    }
+
+    // Process a block of interleaved stereo audio (L R L R ...). The output
+    // pointer may be equal to the input pointer.
+    void process_block_interleaved(const float* in, float* out, int frames) {
+#if defined(NH_UGENS_HARDWARE_FTZ)
+        DenormalGuard denormal_guard;
+#endif
+        begin_block();
+        float left[k_max_chunk_size];
+        float right[k_max_chunk_size];
+        while (frames > 0) {
+            int n = std::min(frames, m_max_chunk_size);
+            for (int i = 0; i < n; i++) {
+                left[i] = in[2 * i];
+                right[i] = in[2 * i + 1];
+            }
+            process_chunk_mixed(left, right, left, right, n);
+            for (int i = 0; i < n; i++) {
+                out[2 * i] = left[i];
+                out[2 * i + 1] = right[i];
+            }
+            in += 2 * n;
+            out += 2 * n;
+            frames -= n;
+        }
+    }
+
+    // In-place variant of the above.
+    void process_block_interleaved(float* buffer, int frames) {
+        process_block_interleaved(buffer, buffer, frames);
+    }
+
+private:
+    template <int, class> friend class NHHallBank;
+    template <int, class, class, class> friend class NHHallPool;
+
+    // Without memory, the delay lines come from the allocator.
+    NHHall(
+        float sample_rate,
+        Alloc allocator,
+        BufferMode buffer_mode,
+        LateRate late_rate,
+        float max_predelay,
+        void* memory,
+        int memory_size
+    ) :
+    m_sample_rate(sample_rate),
+    m_late_sample_rate(get_late_sample_rate(sample_rate, late_rate)),
+    m_buffer_mode(buffer_mode),
+    m_late_rate(late_rate),
+
+    m_lfo(m_late_sample_rate),
+
+    m_decimator(static_cast<int>(late_rate)),
+    m_interpolator(static_cast<int>(late_rate)),
+
+    m_dc_blocker_k(1.0f - twopi * k_dc_blocker_frequency / m_late_sample_rate),
+
+    m_max_predelay(std::max(max_predelay, 0.0f)),
+
+    m_slab(std::move(allocator)),
+
+    m_predelays {{
+        Delay<Storage>(sample_rate, m_max_predelay, buffer_mode),
+        Delay<Storage>(sample_rate, m_max_predelay, buffer_mode)
+    }},
+    m_early_allpasses(make_early_allpasses(sample_rate, buffer_mode)),
+    m_early_delays(make_early_delays(sample_rate, buffer_mode)),
+    m_late_variable_allpasses(make_late_variable_allpasses(m_late_sample_rate, buffer_mode)),
+    m_late_allpasses(make_late_allpasses(m_late_sample_rate, buffer_mode)),
+    m_late_delays(make_late_delays(m_late_sample_rate, buffer_mode))
+
+    {
+        m_k = 0.0f;
+
+        int shortest_late_delay = m_late_delays[0].get_delay_in_samples();
+        for (auto& x : m_late_delays) {
+            shortest_late_delay = std::min(shortest_late_delay, x.get_delay_in_samples());
+        }
+        m_max_chunk_size = k_max_chunk_size;
+        m_max_chunk_size = std::max(std::min(m_max_chunk_size, shortest_late_delay), 1);
+
+        std::array<OutputTap, 8> taps = get_output_taps();
+        for (int j = 0; j < 8; j++) {
+            m_output_tap_offsets[j] = taps[j].time * m_late_sample_rate;
+        }
+
+        m_sleep_hold_samples = k_sleep_hold_time * m_sample_rate;
+        float longest_late_branch = 0.0f;
+        for (int j = 0; j < 4; j++) {
+            longest_late_branch = std::max(
+                longest_late_branch,
+                k_late_delay_times[j] + k_late_variable_allpass_times[j] + k_late_allpass_times[j]
+            );
+        }
+        m_tail_pass_samples = longest_late_branch * m_sample_rate;
+
+        m_target = get_coefficients();
+
+        m_initialization_was_successful = allocate_delay_lines(memory, memory_size);
+    }
+
+    static constexpr float k_delay_time_1 = 153.6e-3f;
+    static constexpr float k_delay_time_2 = 94.3e-3f;
+    static constexpr float k_delay_time_3 = 187.6e-3f;
+    static constexpr float k_delay_time_4 = 123.6e-3f;
+
+    static constexpr float k_average_delay_time =
+        (k_delay_time_1 + k_delay_time_2 + k_delay_time_3 + k_delay_time_4) / 4.0f;
+
+    static constexpr int k_max_chunk_size = 128;
+
+    // The longest chunk process_chunk() may be given, see there.
+    int m_max_chunk_size;
+
+    // Not const, so that NHHall can be move-assigned.
+    float m_sample_rate;
+    float m_late_sample_rate;
+    BufferMode m_buffer_mode;
+    LateRate m_late_rate;
+
+    Stereo m_feedback = {{0.f, 0.f}};
+
+    float m_rotate_cos = 0.0f;
+    float m_rotate_sin = 1.0f;
+
+    RandomLFO m_lfo;
+
+    // Into and out of the late network below full rate.
+    Decimator m_decimator;
+    Interpolator m_interpolator;
+
+    // Auto sleep, see process_chunk. Powers are (left^2 + right^2) / 2, as
+    // in test/rt60. The input must have been silent for longer than a signal
+    // takes through the early section and the longest late delay.
+    static constexpr float k_sleep_hold_time = 0.25f;
+    bool m_auto_sleep = false;
+    bool m_sleeping = false;
+    float m_sleep_threshold = 1e-12f;
+    int m_sleep_hold_samples;
+    int m_silent_input_samples = 0;
+    // Peak output power, decaying no faster than the tail can, and that rate
+    // per sample for the m_k it was worked out for.
+    float m_tail_power = 0.0f;
+    float m_tail_decay = 0.0f;
+    float m_tail_decay_k = -1.0f;
+    float m_tail_pass_samples;
+
+    // Control-rate modulation, see process_late. The LFO offsets of the
+    // variable allpasses in samples, one per lane.
+    int m_mod_control_period = 1;
+    int m_mod_control_timeout = 0;
+    bool m_mod_control_restart = true;
+    float m_modulation[4];
+    float m_modulation_step[4];
+
+    // How far the variable allpasses have faded from the modulated path to
+    // the unmodulated one, from 0 to 1, and where they are headed.
+    enum class LatePath { modulated, unmodulated, fading };
+    static constexpr float k_modulation_fade_time = 10e-3f;
+    float m_unmodulated_mix = 0.0f;
+    float m_unmodulated_target = 0.0f;
+
+    // The damping of the late branches: the low and high shelves multiplied
+    // out into one biquad, in transposed direct form II, and optionally a DC
+    // blocker after it. All four branches share the coefficients, and each
+    // has its own state. See update_shelves.
+    struct Biquad {
+        float b0;
+        float b1;
+        float b2;
+        float a1;
+        float a2;
+    };
+    Biquad m_damping = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    float m_damping_s1[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float m_damping_s2[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    // Without it, DC that gets into the loop while m_k is 1 never leaves. The
+    // cutoff is low enough to leave the decay of the lowest notes alone.
+    static constexpr float k_dc_blocker_frequency = 3.0f;
+    bool m_dc_blocker = false;
+    float m_dc_blocker_k;
+    float m_dc_blocker_x1[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float m_dc_blocker_y1[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    // The settings behind the coefficients that are expensive to work out,
+    // so that posting an unchanged value can be skipped. NaN is never equal,
+    // so the first value always goes through. The shelves stay flat until
+    // their ratio is set, and are up to date for m_k == m_shelf_k.
+    float m_rt60 = std::numeric_limits<float>::quiet_NaN();
+    float m_rt60_k = std::numeric_limits<float>::quiet_NaN();
+    float m_stereo = std::numeric_limits<float>::quiet_NaN();
+    float m_low_shelf_frequency = 0.0f;
+    float m_low_shelf_ratio = 0.0f;
+    float m_hi_shelf_frequency = 0.0f;
+    float m_hi_shelf_ratio = 0.0f;
+    float m_shelf_k = 0.0f;
+    bool m_shelves_dirty = false;
+
+    // Parameter smoothing, see process_chunk_ramped. With smoothing off, the
+    // setters write both the coefficients and m_target.
+    struct SmoothedCoefficients {
+        float k;
+        float rotate_cos;
+        float rotate_sin;
+        float early_allpass_k[8];
+        float variable_allpass_k[4];
+        float allpass_k[4];
+        Biquad damping;
+    };
+    SmoothedCoefficients m_target;
+    int m_smoothing_samples = 0;
+    int m_ramp_remaining = 0;
+
+    ParameterQueue m_parameter_queue;
+
+    // The predelay in front of the reverb and the output stage behind it,
+    // see process_chunk_mixed. Both are skipped until one of their setters
+    // is called. The output settings ramp like the coefficients above when
+    // smoothing is on, but on their own, so that the dry signal doesn't
+    // depend on whether the reverb is asleep.
+    struct OutputSettings {
+        float dry;
+        float wet;
+        float tilt_g;
+        float tilt_gain;
+    };
+    bool m_output_stage = false;
+    float m_max_predelay;
+    int m_predelay_samples = 0;
+    float m_dry = 0.0f;
+    float m_wet = 1.0f;
+    float m_output_gain = 1.0f;
+    float m_tilt_frequency = 0.0f;
+    float m_tilt_db = 0.0f;
+    OutputSettings m_output = {0.0f, 1.0f, 1.0f, 1.0f};
+    OutputSettings m_output_target = {0.0f, 1.0f, 1.0f, 1.0f};
+    int m_output_ramp_remaining = 0;
+    Stereo m_tilt_state = {{0.0f, 0.0f}};
+
+    // NOTE: When adding new delay units, don't forget to add them to
+    // get_processing_order so they get their share of the slab.
+    OwnedSlab<Alloc> m_slab;
+
+    // Not part of the network, so not in get_processing_order, but first in
+    // the slab. See get_slab_units.
+    std::array<Delay<Storage>, 2> m_predelays;
+
+    std::array<Allpass<Storage>, 8> m_early_allpasses;
+    std::array<Delay<Storage>, 4> m_early_delays;
+
+    std::array<VariableAllpass<Storage, Interpolation>, 4> m_late_variable_allpasses;
+    std::array<Allpass<Storage>, 4> m_late_allpasses;
+    std::array<Delay<Storage>, 4> m_late_delays;
+
+    // Delay times of the units, in seconds. required_bytes() works out the
+    // buffer sizes from these at compile time.
+    static constexpr float k_early_allpass_times[8] = {
+        9.5e-3f, 12.0e-3f, 7.8e-3f, 14.2e-3f, 23.5e-3f, 8.0e-3f, 25.8e-3f, 7.2e-3f
+    };
+    static constexpr float k_early_delay_times[4] = {5.45e-3, 3.25e-3, 2.36e-3, 7.17e-3};
+    static constexpr float k_late_variable_allpass_times[4] = {25.6e-3f, 50.7e-3f, 68.6e-3f, 45.7e-3f};
+    static constexpr float k_late_allpass_times[4] = {41.4e-3f, 25.6e-3f, 29.4e-3f, 23.6e-3f};
+    static constexpr float k_late_delay_times[4] = {
+        k_delay_time_1, k_delay_time_2, k_delay_time_3, k_delay_time_4
+    };
+
+    // The delay units of the network. These are shared with NHHallBank.
+    static std::array<Allpass<Storage>, 8> make_early_allpasses(float sample_rate, BufferMode buffer_mode) {
+        std::array<Allpass<Storage>, 8> result {{
+            Allpass<Storage>(sample_rate, k_early_allpass_times[0], 1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[1], -1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[2], 1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[3], -1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[4], 1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[5], -1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[6], 1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_early_allpass_times[7], -1, buffer_mode)
+        }};
+        return result;
+    }
+
+    static std::array<Delay<Storage>, 4> make_early_delays(float sample_rate, BufferMode buffer_mode) {
+        std::array<Delay<Storage>, 4> result {{
+            Delay<Storage>(sample_rate, k_early_delay_times[0], buffer_mode),
+            Delay<Storage>(sample_rate, k_early_delay_times[1], buffer_mode),
+            Delay<Storage>(sample_rate, k_early_delay_times[2], buffer_mode),
+            Delay<Storage>(sample_rate, k_early_delay_times[3], buffer_mode)
+        }};
+        return result;
+    }
+
+    static std::array<VariableAllpass<Storage, Interpolation>, 4> make_late_variable_allpasses(float sample_rate, BufferMode buffer_mode) {
+        std::array<VariableAllpass<Storage, Interpolation>, 4> result {{
+            VariableAllpass<Storage, Interpolation>(sample_rate, k_late_variable_allpass_times[0], RandomLFO::k_max_amplitude, 1, buffer_mode),
+            VariableAllpass<Storage, Interpolation>(sample_rate, k_late_variable_allpass_times[1], RandomLFO::k_max_amplitude, -1, buffer_mode),
+            VariableAllpass<Storage, Interpolation>(sample_rate, k_late_variable_allpass_times[2], RandomLFO::k_max_amplitude, 1, buffer_mode),
+            VariableAllpass<Storage, Interpolation>(sample_rate, k_late_variable_allpass_times[3], RandomLFO::k_max_amplitude, -1, buffer_mode)
+        }};
+        return result;
+    }
+
+    static std::array<Allpass<Storage>, 4> make_late_allpasses(float sample_rate, BufferMode buffer_mode) {
+        std::array<Allpass<Storage>, 4> result {{
+            Allpass<Storage>(sample_rate, k_late_allpass_times[0], -1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_late_allpass_times[1], 1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_late_allpass_times[2], -1, buffer_mode),
+            Allpass<Storage>(sample_rate, k_late_allpass_times[3], 1, buffer_mode)
+        }};
+        return result;
+    }
+
+    static std::array<Delay<Storage>, 4> make_late_delays(float sample_rate, BufferMode buffer_mode) {
+        std::array<Delay<Storage>, 4> result {{
+            Delay<Storage>(sample_rate, k_late_delay_times[0], buffer_mode),
+            Delay<Storage>(sample_rate, k_late_delay_times[1], buffer_mode),
+            Delay<Storage>(sample_rate, k_late_delay_times[2], buffer_mode),
+            Delay<Storage>(sample_rate, k_late_delay_times[3], buffer_mode)
+        }};
+        return result;
+    }
+
+    // Taps on the late delays that make up the output, in the order they are
+    // summed. Keep the inter-channel delays somewhere between 0.1 and 0.7 ms
+    // -- this allows the Haas effect to come in.
+    struct OutputTap {
+        int delay;
+        int channel;
+        float time;
+        float gain;
+    };
+
+    // The tap times in samples, worked out once in the constructor.
+    int m_output_tap_offsets[8];
+
+    static std::array<OutputTap, 8> get_output_taps(void) {
+        const float haas_multiplier = -0.6f;
+        std::array<OutputTap, 8> result {{
+            {0, 0, 0.0e-3f, 1.0f},
+            {0, 1, 0.3e-3f, haas_multiplier},
+            {1, 0, 0.0e-3f, 1.0f},
+            {1, 1, 0.1e-3f, haas_multiplier},
+            {2, 0, 0.7e-3f, haas_multiplier},
+            {2, 1, 0.0e-3f, 1.0f},
+            {3, 0, 0.2e-3f, haas_multiplier},
+            {3, 1, 0.0e-3f, 1.0f}
+        }};
+        return result;
+    }
+
+    // All delay lines live in one allocation, the slab, laid out in the
+    // order they are processed. Each one starts on a cache line, and is
+    // followed by one cache line of padding: the buffers are powers of two,
+    // and laid end to end they would all start on the same cache sets.
+    static constexpr int k_cache_line_size = 64;
+
+    static constexpr int get_slab_stride(int bytes) {
+        return (bytes + 2 * k_cache_line_size - 1) / k_cache_line_size * k_cache_line_size;
+    }
+
+    template <class Unit, class EarlyAllpasses, class EarlyDelays, class LateVariableAllpasses, class LateAllpasses, class LateDelays>
+    static std::array<Unit*, 24> get_processing_order(
+        EarlyAllpasses& early_allpasses,
+        EarlyDelays& early_delays,
+        LateVariableAllpasses& late_variable_allpasses,
+        LateAllpasses& late_allpasses,
+        LateDelays& late_delays
+    ) {
+        std::array<Unit*, 24> result {{
+            &early_allpasses[0], &early_allpasses[1],
+            &early_allpasses[2], &early_allpasses[3],
+            &early_delays[0], &early_delays[1],
+            &early_allpasses[4], &early_allpasses[5],
+            &early_allpasses[6], &early_allpasses[7],
+            &early_delays[2], &early_delays[3],
+            &late_delays[0], &late_variable_allpasses[0], &late_allpasses[0],
+            &late_delays[1], &late_variable_allpasses[1], &late_allpasses[1],
+            &late_delays[2], &late_variable_allpasses[2], &late_allpasses[2],
+            &late_delays[3], &late_variable_allpasses[3], &late_allpasses[3]
+        }};
+        return result;
+    }
+
+    // Size of the slab for the given delay lines, each holding a number of
+    // interleaved lanes, including the slack needed to align it.
+    template <class Unit, size_t N>
+    static int get_slab_size(const std::array<Unit*, N>& units, int lanes) {
+        int result = k_cache_line_size - 1;
+        for (const Unit* x : units) {
+            result += get_slab_stride(sizeof(*x->m_buffer) * x->m_size * lanes);
+        }
+        return result;
+    }
+
+    // Point the delay lines into a slab of get_slab_size() bytes at memory,
+    // clearing them unless the memory is known to be zero already.
+    template <class Unit, size_t N>
+    static void carve_slab(void* memory, const std::array<Unit*, N>& units, int lanes, bool clear = true) {
+        uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+        address = (address + k_cache_line_size - 1) & ~static_cast<uintptr_t>(k_cache_line_size - 1);
+        char* position = reinterpret_cast<char*>(address);
+        for (Unit* x : units) {
+            int bytes = sizeof(*x->m_buffer) * x->m_size * lanes;
+            x->m_buffer = reinterpret_cast<decltype(x->m_buffer)>(position);
+            if (clear) {
+                memset(position, 0, bytes);
+            }
+            position += get_slab_stride(bytes);
+        }
+    }
+
+    // Allocate the slab and point the delay lines into it. Returns the
+    // allocation, to be passed to deallocate(), or nullptr on failure.
+    // Uses allocate_zeroed() if the allocator has it.
+    template <class Unit, size_t N>
+    static void* allocate_slab(Alloc& allocator, const std::array<Unit*, N>& units, int lanes) {
+        const bool zeroed = HasAllocateZeroed<Alloc>::value;
+        void* memory = allocate_memory(
+            allocator,
+            get_slab_size(units, lanes),
+            std::integral_constant<bool, zeroed>()
+        );
+        if (!memory) {
+            return nullptr;
+        }
+        carve_slab(memory, units, lanes, !zeroed);
+        return memory;
+    }
+
+    static void* allocate_memory(Alloc& allocator, int memory_size, std::true_type) {
+        return allocator.allocate_zeroed(memory_size);
+    }
+
+    static void* allocate_memory(Alloc& allocator, int memory_size, std::false_type) {
+        return allocator.allocate(memory_size);
+    }
+
+    // Compile-time versions of the buffer sizes BaseDelay picks, which must
+    // agree with it down to the float rounding.
+    static constexpr int get_buffer_size(float sample_rate, float max_delay, BufferMode buffer_mode) {
+        return buffer_mode == BufferMode::exact
+            ? (static_cast<int>(sample_rate * max_delay) > 1 ? static_cast<int>(sample_rate * max_delay) : 1)
+            : next_power_of_two(sample_rate * max_delay);
+    }
+
+    static constexpr float get_max_delay(float sample_rate, float delay, bool modulated) {
+        return modulated
+            ? static_cast<float>(delay + RandomLFO::k_max_amplitude + 4.0 / sample_rate)
+            : delay;
+    }
+
+    static constexpr int get_slab_strides(
+        float sample_rate,
+        int lanes,
+        BufferMode buffer_mode,
+        const float* delays,
+        int count,
+        bool modulated
+    ) {
+        return count == 0 ? 0 :
+            get_slab_stride(
+                sizeof(typename Storage::Sample) * lanes *
+                get_buffer_size(sample_rate, get_max_delay(sample_rate, delays[0], modulated), buffer_mode)
+            )
+            + get_slab_strides(sample_rate, lanes, buffer_mode, delays + 1, count - 1, modulated);
+    }
+
+    static constexpr float get_late_sample_rate(float sample_rate, LateRate late_rate) {
+        return sample_rate / static_cast<int>(late_rate);
+    }
+
+    static constexpr int get_required_bytes(
+        float sample_rate,
+        int lanes,
+        BufferMode buffer_mode,
+        LateRate late_rate = LateRate::full
+    ) {
+        return k_cache_line_size - 1
+            + get_slab_strides(sample_rate, lanes, buffer_mode, k_early_allpass_times, 8, false)
+            + get_slab_strides(sample_rate, lanes, buffer_mode, k_early_delay_times, 4, false)
+            + get_slab_strides(get_late_sample_rate(sample_rate, late_rate), lanes, buffer_mode, k_late_variable_allpass_times, 4, true)
+            + get_slab_strides(get_late_sample_rate(sample_rate, late_rate), lanes, buffer_mode, k_late_allpass_times, 4, false)
+            + get_slab_strides(get_late_sample_rate(sample_rate, late_rate), lanes, buffer_mode, k_late_delay_times, 4, false);
+    }
+
+    // The predelays, then the network in processing order.
+    std::array<BaseDelay<Storage>*, 26> get_slab_units(void) {
+        std::array<BaseDelay<Storage>*, 24> network = get_processing_order<BaseDelay<Storage>>(
+            m_early_allpasses,
+            m_early_delays,
+            m_late_variable_allpasses,
+            m_late_allpasses,
+            m_late_delays
+        );
+        std::array<BaseDelay<Storage>*, 26> result;
+        result[0] = &m_predelays[0];
+        result[1] = &m_predelays[1];
+        std::copy(network.begin(), network.end(), result.begin() + 2);
+        return result;
+    }
+
+    bool allocate_delay_lines(void* memory, int memory_size) {
+        std::array<BaseDelay<Storage>*, 26> units = get_slab_units();
+        if (memory == nullptr) {
+            m_slab.m_memory = allocate_slab(m_slab.m_allocator, units, 1);
+            return m_slab.m_memory != nullptr;
+        }
+        if (memory_size < get_slab_size(units, 1)) {
+            return false;
+        }
+        carve_slab(memory, units, 1);
+        return true;
+    }
+
+    // The reverb is processed in chunks. The early section runs one unit at a
+    // time, each allpass and delay over the whole chunk before the next one
+    // starts, which keeps its buffer hot in cache. The late network is a
+    // feedback loop, so it runs sample by sample, but with its four branches
+    // side by side (see process_late). The output taps are read from the late
+    // delays afterwards, which works as long as the chunk is no longer than
+    // the shortest late delay.
+    //
+    // Below full rate, the early signal is decimated on its way into the late
+    // network, and the sum of the output taps is interpolated back up. The
+    // interpolator runs one low-rate sample behind, so that it always has
+    // outputs ready; the late tail is the better part of 100 ms behind the
+    // input anyway.
+    //
+    // With auto sleep on, the reverb goes to sleep once its input has been
+    // quiet for a while and its output has decayed below the threshold. It
+    // silences all of its state and outputs zeros, looking only at the input
+    // until that rises above the threshold again. Because the state is
+    // silent, it wakes up exactly as a fresh reverb would.
+    void process_chunk(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int n
+    ) {
+        if (!m_auto_sleep) {
+            process_chunk_awake(in_left, in_right, out_left, out_right, n);
+            return;
+        }
+
+        // Count the quiet samples at the end of the input before the output
+        // overwrites it.
+        int quiet = 0;
+        while (quiet < n) {
+            float x_left = in_left[n - 1 - quiet];
+            float x_right = in_right[n - 1 - quiet];
+            if ((x_left * x_left + x_right * x_right) * 0.5f >= m_sleep_threshold) {
+                break;
+            }
+            quiet++;
+        }
+
+        if (m_sleeping) {
+            if (quiet == n) {
+                for (int i = 0; i < n; i++) {
+                    out_left[i] = 0.0f;
+                    out_right[i] = 0.0f;
+                }
+                return;
+            }
+            m_sleeping = false;
+            m_tail_power = 0.0f;
+        }
+
+        process_chunk_awake(in_left, in_right, out_left, out_right, n);
+
+        m_silent_input_samples = quiet == n ? m_silent_input_samples + n : quiet;
+        if (m_tail_decay_k != m_k) {
+            m_tail_decay = compute_tail_decay();
+            m_tail_decay_k = m_k;
+        }
+        float tail_power = m_tail_power;
+        for (int i = 0; i < n; i++) {
+            float power = (out_left[i] * out_left[i] + out_right[i] * out_right[i]) * 0.5f;
+            tail_power = std::max(power, tail_power * m_tail_decay);
+        }
+        m_tail_power = flush_denormals(tail_power);
+
+        if (m_silent_input_samples >= m_sleep_hold_samples && m_tail_power < m_sleep_threshold) {
+            clear_state();
+            m_sleeping = true;
+        }
+    }
+
+    // Output power lost per sample by the slowest decaying band of the tail.
+    // Each pass through a late branch scales it by m_k and the damping at DC
+    // or Nyquist, whichever boosts most. The allpasses of a branch delay it
+    // by their length on average, so the passes take longer than
+    // k_average_delay_time, and the longest branch gives the slowest decay.
+    float compute_tail_decay(void) const {
+        const Biquad& d = m_damping;
+        float dc = (d.b0 + d.b1 + d.b2) / (1.0f + d.a1 + d.a2);
+        float nyquist = (d.b0 - d.b1 + d.b2) / (1.0f - d.a1 + d.a2);
+        float gain = m_k * std::max(1.0f, std::max(std::abs(dc), std::abs(nyquist)));
+        return powf(gain * gain, 1.0f / m_tail_pass_samples);
+    }
+
+    // Process any number of samples, a chunk at a time.
+    void process_span(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int frames
+    ) {
+        while (frames > 0) {
+            int n = std::min(frames, m_max_chunk_size);
+            process_chunk_mixed(in_left, in_right, out_left, out_right, n);
+            in_left += n;
+            in_right += n;
+            out_left += n;
+            out_right += n;
+            frames -= n;
+        }
+    }
+
+    // The predelay, process_chunk and the output stage, one after the other
+    // on each chunk while it is in cache, so that the audio goes through
+    // memory once. The dry signal is copied aside first, as out may be in.
+    // The predelay is outside process_chunk so that it keeps running while
+    // the reverb sleeps: process_chunk sees its output as the input.
+    void process_chunk_mixed(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int n
+    ) {
+        if (!m_output_stage) {
+            process_chunk(in_left, in_right, out_left, out_right, n);
+            return;
+        }
+
+        float dry_left[k_max_chunk_size];
+        float dry_right[k_max_chunk_size];
+        for (int i = 0; i < n; i++) {
+            dry_left[i] = in_left[i];
+            dry_right[i] = in_right[i];
+        }
+
+        if (m_predelay_samples > 0) {
+            float predelayed_left[k_max_chunk_size];
+            float predelayed_right[k_max_chunk_size];
+            m_predelays[0].process(dry_left, predelayed_left, n);
+            m_predelays[1].process(dry_right, predelayed_right, n);
+            process_chunk(predelayed_left, predelayed_right, out_left, out_right, n);
+        } else {
+            process_chunk(dry_left, dry_right, out_left, out_right, n);
+        }
+
+        int ramped = std::min(n, m_output_ramp_remaining);
+        if (ramped > 0) {
+            OutputSettings end = m_output_target;
+            if (ramped < m_output_ramp_remaining) {
+                const OutputSettings& start = m_output;
+                float t = static_cast<float>(ramped) / m_output_ramp_remaining;
+                end.dry = start.dry + (end.dry - start.dry) * t;
+                end.wet = start.wet + (end.wet - start.wet) * t;
+                end.tilt_g = start.tilt_g + (end.tilt_g - start.tilt_g) * t;
+                end.tilt_gain = start.tilt_gain + (end.tilt_gain - start.tilt_gain) * t;
+            }
+            m_output_ramp_remaining -= ramped;
+            process_output<true>(dry_left, dry_right, out_left, out_right, ramped, end);
+        }
+        if (ramped < n) {
+            process_output<false>(
+                dry_left + ramped, dry_right + ramped, out_left + ramped, out_right + ramped, n - ramped, m_output
+            );
+        }
+    }
+
+    // Tilt the wet signal in out and mix in the dry signal, going from
+    // m_output to end over the n samples if Ramped.
+    template <bool Ramped>
+    void process_output(
+        const float* dry_left,
+        const float* dry_right,
+        float* out_left,
+        float* out_right,
+        int n,
+        const OutputSettings& end
+    ) {
+        float dry = m_output.dry;
+        float wet = m_output.wet;
+        float g = m_output.tilt_g;
+        float gain = m_output.tilt_gain;
+        const float scale = 1.0f / n;
+        const float dry_step = (end.dry - dry) * scale;
+        const float wet_step = (end.wet - wet) * scale;
+        const float g_step = (end.tilt_g - g) * scale;
+        const float gain_step = (end.tilt_gain - gain) * scale;
+        const bool tilted = Ramped || gain != 1.0f;
+
+        Stereo s = m_tilt_state;
+        for (int i = 0; i < n; i++) {
+            float left = out_left[i];
+            float right = out_right[i];
+            if (tilted) {
+                // See LowShelf::process.
+                float v = (left - s[0]) * g;
+                float y_lp = v + s[0];
+                s[0] = y_lp + v;
+                left = left - y_lp + gain * y_lp;
+
+                v = (right - s[1]) * g;
+                y_lp = v + s[1];
+                s[1] = y_lp + v;
+                right = right - y_lp + gain * y_lp;
+            }
+            out_left[i] = left * wet + dry_left[i] * dry;
+            out_right[i] = right * wet + dry_right[i] * dry;
+            if (Ramped) {
+                dry += dry_step;
+                wet += wet_step;
+                g += g_step;
+                gain += gain_step;
+            }
+        }
+        m_tilt_state = flush_denormals(s);
+        m_output = end;
+    }
+
+    // Apply the posted parameter changes, then bring the shelves up to date.
+    // Only the last change of each parameter counts, and they are applied in
+    // the order of Parameter, so rt60 comes before the shelves that depend
+    // on it.
+    void begin_block(void) {
+        if (m_smoothing_samples == 0) {
+            m_target.k = m_k;
+        }
+        ParameterChange change;
+        if (m_parameter_queue.pop(change)) {
+            ParameterChange latest[static_cast<int>(Parameter::count)];
+            unsigned posted = 0;
+            do {
+                int index = static_cast<int>(change.parameter);
+                latest[index] = change;
+                posted |= 1u << index;
+            } while (m_parameter_queue.pop(change));
+            for (int i = 0; i < static_cast<int>(Parameter::count); i++) {
+                if (posted & (1u << i)) {
+                    apply_parameter(latest[i]);
+                }
+            }
+        }
+        update_shelves();
+    }
+
+    // True if begin_block() would change nothing: no posted changes, and
+    // the shelves and the target m_k are up to date.
+    bool block_start_is_idle(void) const {
+        return m_parameter_queue.looks_empty()
+            && !m_shelves_dirty
+            && m_target.k == m_shelf_k
+            && (m_smoothing_samples != 0 || m_target.k == m_k);
+    }
+
+    void apply_parameter(const ParameterChange& change) {
+        switch (change.parameter) {
+            case Parameter::rt60:
+                if (change.value != m_rt60 || m_target.k != m_rt60_k) {
+                    set_rt60(change.value);
+                }
+                break;
+            case Parameter::k:
+                if (change.value != m_target.k) {
+                    set_k(change.value);
+                }
+                break;
+            case Parameter::stereo:
+                if (change.value != m_stereo) {
+                    set_stereo(change.value);
+                }
+                break;
+            case Parameter::low_shelf:
+                if (change.value != m_low_shelf_frequency || change.value2 != m_low_shelf_ratio) {
+                    set_low_shelf_parameters(change.value, change.value2);
+                }
+                break;
+            case Parameter::hi_shelf:
+                if (change.value != m_hi_shelf_frequency || change.value2 != m_hi_shelf_ratio) {
+                    set_hi_shelf_parameters(change.value, change.value2);
+                }
+                break;
+            case Parameter::early_diffusion:
+                set_early_diffusion(change.value);
+                break;
+            case Parameter::late_diffusion:
+                set_late_diffusion(change.value);
+                break;
+            case Parameter::mod_rate:
+                set_mod_rate(change.value);
+                break;
+            case Parameter::mod_depth:
+                set_mod_depth(change.value);
+                break;
+            case Parameter::predelay:
+                set_predelay(change.value);
+                break;
+            case Parameter::tilt:
+                set_tilt(change.value, change.value2);
+                break;
+            case Parameter::dry_wet:
+                set_dry_wet(change.value, change.value2);
+                break;
+            case Parameter::output_gain:
+                set_output_gain(change.value);
+                break;
+            case Parameter::count:
+                break;
+        }
+    }
+
+    // Work out both sets of shelves from their settings and the target m_k,
+    // so that they never lag behind each other or the decay time. Does
+    // nothing if neither has changed.
+    void update_shelves(void) {
+        if (!m_shelves_dirty && m_target.k == m_shelf_k) {
+            return;
+        }
+        m_target.damping = get_damping(
+            m_late_sample_rate,
+            m_target.k,
+            m_low_shelf_frequency,
+            m_low_shelf_ratio,
+            m_hi_shelf_frequency,
+            m_hi_shelf_ratio
+        );
+        if (m_smoothing_samples == 0) {
+            m_damping = m_target.damping;
+        } else {
+            start_ramp();
+        }
+        m_shelf_k = m_target.k;
+        m_shelves_dirty = false;
+        m_tail_decay_k = -1.0f;
+    }
+
+    // A shelf as the first-order section (n0 + n1 z^-1) / (1 - p z^-1):
+    // lp_gain times the lowpass plus hp_gain times the highpass of the
+    // one-pole in LowShelf::process with coefficient g. A flat shelf has no
+    // pole, rather than one cancelled by its zero.
+    struct ShelfSection {
+        float n0;
+        float n1;
+        float p;
+    };
+
+    static ShelfSection get_shelf_section(float g, float lp_gain, float hp_gain) {
+        if (lp_gain == hp_gain) {
+            ShelfSection flat = {lp_gain, 0.0f, 0.0f};
+            return flat;
+        }
+        ShelfSection section = {
+            lp_gain * g + hp_gain * (1.0f - g),
+            lp_gain * g - hp_gain * (1.0f - g),
+            1.0f - 2.0f * g
+        };
+        return section;
+    }
+
+    // Both shelves for decay factor k, multiplied out. A ratio of 0 leaves
+    // that shelf flat. Shared with NHHallBank.
+    static Biquad get_damping(
+        float sample_rate,
+        float k,
+        float low_shelf_frequency,
+        float low_shelf_ratio,
+        float hi_shelf_frequency,
+        float hi_shelf_ratio
+    ) {
+        ShelfSection low = {1.0f, 0.0f, 0.0f};
+        ShelfSection hi = {1.0f, 0.0f, 0.0f};
+        if (low_shelf_ratio != 0.0f) {
+            float gain = powf(k, 1.0f / low_shelf_ratio - 1.0f);
+            LowShelf shelf(sample_rate);
+            shelf.set_parameters(low_shelf_frequency, std::max(gain, 0.01f));
+            low = get_shelf_section(shelf.m_g, shelf.m_gain, 1.0f);
+        }
+        if (hi_shelf_ratio != 0.0f) {
+            float gain = powf(k, 1.0f / hi_shelf_ratio - 1.0f);
+            HiShelf shelf(sample_rate);
+            shelf.set_parameters(hi_shelf_frequency, std::max(gain, 0.01f));
+            hi = get_shelf_section(shelf.m_g, 1.0f, shelf.m_gain);
+        }
+        Biquad damping;
+        damping.b0 = low.n0 * hi.n0;
+        damping.b1 = low.n0 * hi.n1 + low.n1 * hi.n0;
+        damping.b2 = low.n1 * hi.n1;
+        damping.a1 = -(low.p + hi.p);
+        damping.a2 = low.p * hi.p;
+        return damping;
+    }
+
+    void start_ramp(void) {
+        m_ramp_remaining = m_smoothing_samples;
+    }
+
+    void snap_to_target(void) {
+        set_coefficients(m_target);
+        m_ramp_remaining = 0;
+        m_output = m_output_target;
+        m_output_ramp_remaining = 0;
+    }
+
+    // The tilt is a low shelf whose gain is the bass relative to the
+    // treble, with the treble gain folded into the wet gain. Unlike the
+    // damping shelves, its cutoff is prewarped and placed so that the gain
+    // is halfway, in dB, at m_tilt_frequency.
+    void update_output_stage(void) {
+        float gain = powf(10.0f, -m_tilt_db / 20.0f);
+        float frequency = std::min(std::max(m_tilt_frequency, 0.0f), m_sample_rate * 0.49f);
+        float x = tanf(twopi * 0.5f * frequency / m_sample_rate) / sqrtf(gain);
+        m_output_target.dry = m_dry * m_output_gain;
+        m_output_target.wet = m_wet * m_output_gain * powf(10.0f, m_tilt_db / 40.0f);
+        m_output_target.tilt_g = x / (1.0f + x);
+        m_output_target.tilt_gain = gain;
+        if (m_smoothing_samples == 0) {
+            m_output = m_output_target;
+        } else {
+            m_output_ramp_remaining = m_smoothing_samples;
+        }
+        m_output_stage = true;
+    }
+
+    SmoothedCoefficients get_coefficients(void) const {
+        SmoothedCoefficients c;
+        c.k = m_k;
+        c.rotate_cos = m_rotate_cos;
+        c.rotate_sin = m_rotate_sin;
+        for (int j = 0; j < 8; j++) {
+            c.early_allpass_k[j] = m_early_allpasses[j].m_k;
+        }
+        for (int j = 0; j < 4; j++) {
+            c.variable_allpass_k[j] = m_late_variable_allpasses[j].m_k;
+            c.allpass_k[j] = m_late_allpasses[j].m_k;
+        }
+        c.damping = m_damping;
+        return c;
+    }
+
+    void set_coefficients(const SmoothedCoefficients& c) {
+        m_k = c.k;
+        m_rotate_cos = c.rotate_cos;
+        m_rotate_sin = c.rotate_sin;
+        for (int j = 0; j < 8; j++) {
+            m_early_allpasses[j].m_k = c.early_allpass_k[j];
+        }
+        for (int j = 0; j < 4; j++) {
+            m_late_variable_allpasses[j].m_k = c.variable_allpass_k[j];
+            m_late_allpasses[j].m_k = c.allpass_k[j];
+        }
+        m_damping = c.damping;
+    }
+
+    // f(a, b) for each coefficient.
+    template <class F>
+    static SmoothedCoefficients combine(
+        const SmoothedCoefficients& a,
+        const SmoothedCoefficients& b,
+        F f
+    ) {
+        SmoothedCoefficients c;
+        c.k = f(a.k, b.k);
+        c.rotate_cos = f(a.rotate_cos, b.rotate_cos);
+        c.rotate_sin = f(a.rotate_sin, b.rotate_sin);
+        for (int j = 0; j < 8; j++) {
+            c.early_allpass_k[j] = f(a.early_allpass_k[j], b.early_allpass_k[j]);
+        }
+        for (int j = 0; j < 4; j++) {
+            c.variable_allpass_k[j] = f(a.variable_allpass_k[j], b.variable_allpass_k[j]);
+            c.allpass_k[j] = f(a.allpass_k[j], b.allpass_k[j]);
+        }
+        c.damping.b0 = f(a.damping.b0, b.damping.b0);
+        c.damping.b1 = f(a.damping.b1, b.damping.b1);
+        c.damping.b2 = f(a.damping.b2, b.damping.b2);
+        c.damping.a1 = f(a.damping.a1, b.damping.a1);
+        c.damping.a2 = f(a.damping.a2, b.damping.a2);
+        return c;
+    }
+
+    static SmoothedCoefficients interpolate(
+        const SmoothedCoefficients& a,
+        const SmoothedCoefficients& b,
+        float t
+    ) {
+        return combine(a, b, [t](float x, float y) { return x + (y - x) * t; });
+    }
+
+    // What to add per sample to go from a to b in n samples.
+    static SmoothedCoefficients get_steps(
+        const SmoothedCoefficients& a,
+        const SmoothedCoefficients& b,
+        int n
+    ) {
+        const float scale = 1.0f / n;
+        return combine(a, b, [scale](float x, float y) { return (y - x) * scale; });
+    }
+
+    // Silence every delay line and filter, leaving parameters and the LFO
+    // alone. Only the parts of the buffers written since they were last
+    // cleared need zeroing, so this costs as much as the reverb has been
+    // used, up to the size of the slab.
+    void clear_state(void) {
+        std::array<BaseDelay<Storage>*, 24> units = get_processing_order<BaseDelay<Storage>>(
+            m_early_allpasses,
+            m_early_delays,
+            m_late_variable_allpasses,
+            m_late_allpasses,
+            m_late_delays
+        );
+        for (BaseDelay<Storage>* x : units) {
+            x->reset();
+        }
+        for (auto& x : m_late_variable_allpasses) {
+            x.m_interpolation_state = 0.0f;
+        }
+        for (int j = 0; j < 4; j++) {
+            m_damping_s1[j] = 0.0f;
+            m_damping_s2[j] = 0.0f;
+            m_dc_blocker_x1[j] = 0.0f;
+            m_dc_blocker_y1[j] = 0.0f;
+        }
+        m_feedback[0] = 0.0f;
+        m_feedback[1] = 0.0f;
+        m_decimator.reset();
+        m_interpolator.reset();
+    }
+
+    void process_chunk_awake(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int n
+    ) {
+        if (m_ramp_remaining > 0) {
+            int ramped = std::min(n, m_ramp_remaining);
+            process_chunk_ramped(in_left, in_right, out_left, out_right, ramped);
+            if (ramped == n) {
+                return;
+            }
+            in_left += ramped;
+            in_right += ramped;
+            out_left += ramped;
+            out_right += ramped;
+            n -= ramped;
+        }
+        process_chunk_with(in_left, in_right, out_left, out_right, n, nullptr);
+    }
+
+    // Move the coefficients n samples along their ramp to m_target. They
+    // all step every sample, those of the late network as Float4 lanes
+    // in the late loop. Rotating by linearly interpolated cos and sin isn't
+    // quite a rotation halfway, but it stays within a few percent of one
+    // for any stereo change.
+    void process_chunk_ramped(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int n
+    ) {
+        SmoothedCoefficients end = m_target;
+        if (n < m_ramp_remaining) {
+            end = interpolate(get_coefficients(), m_target, static_cast<float>(n) / m_ramp_remaining);
+        }
+        m_ramp_remaining -= n;
+        process_chunk_with(in_left, in_right, out_left, out_right, n, &end);
+        set_coefficients(end);
+        m_tail_decay_k = -1.0f;
+    }
+
+    // With end given, the rotation and late coefficients ramp from their
+    // current values to those in end over the chunk. A nonzero Frames fixes
+    // n at compile time, so that process() gets a copy with the chunk loops
+    // folded away.
+    template <int Frames = 0>
+    void process_chunk_with(
+        const float* in_left,
+        const float* in_right,
+        float* out_left,
+        float* out_right,
+        int n,
+        const SmoothedCoefficients* end
+    ) {
+        if (Frames > 0) {
+            n = Frames;
+        }
+        const float k = m_k;
+        const float rotate_cos = m_rotate_cos;
+        const float rotate_sin = m_rotate_sin;
+
+        float early_left[k_max_chunk_size];
+        float early_right[k_max_chunk_size];
+
+        SmoothedCoefficients steps;
+        const SmoothedCoefficients* ramp = nullptr;
+        if (end != nullptr) {
+            steps = get_steps(get_coefficients(), *end, n);
+            ramp = &steps;
+        }
+        process_early(in_left, in_right, early_left, early_right, n, rotate_cos, rotate_sin, ramp);
+        if (m_late_rate == LateRate::full) {
+            process_late(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+            process_outputs(early_left, early_right, out_left, out_right, n);
+            return;
+        }
+
+        float late_left[k_max_chunk_size];
+        float late_right[k_max_chunk_size];
+        int m = m_decimator.process(early_left, early_right, late_left, late_right, n);
+        if (m > 0) {
+            if (end != nullptr) {
+                steps = get_steps(get_coefficients(), *end, m);
+            }
+            process_late(late_left, late_right, m, k, rotate_cos, rotate_sin, ramp);
+        }
+        for (int i = 0; i < m; i++) {
+            late_left[i] = 0.0f;
+            late_right[i] = 0.0f;
+        }
+        add_taps(late_left, late_right, m);
+        m_interpolator.process(late_left, late_right, m, out_left, out_right, n);
+        for (int i = 0; i < n; i++) {
+            out_left[i] += early_left[i] * 0.5f;
+            out_right[i] += early_right[i] * 0.5f;
+        }
+    }
+
+    inline void process_early(
+        const float* in_left,
+        const float* in_right,
+        float* early_left,
+        float* early_right,
+        int n,
+        float rotate_cos,
+        float rotate_sin,
+        const SmoothedCoefficients* ramp
+    ) {
+        float sig_left[k_max_chunk_size];
+        float sig_right[k_max_chunk_size];
+
+        // early_* is scratch until the first rotation is copied into it.
+        process_early_allpass(0, in_left, early_left, n, ramp);
+        process_early_allpass(1, early_left, sig_left, n, ramp);
+        process_early_allpass(2, in_right, early_right, n, ramp);
+        process_early_allpass(3, early_right, sig_right, n, ramp);
+        if (ramp != nullptr) {
+            rotate(sig_left, sig_right, n, rotate_cos, rotate_sin, ramp->rotate_cos, ramp->rotate_sin);
+        } else {
+            rotate(sig_left, sig_right, n, rotate_cos, rotate_sin);
+        }
+        for (int i = 0; i < n; i++) {
+            early_left[i] = sig_left[i];
+            early_right[i] = sig_right[i];
+        }
+
+        // early_* holds the same samples as sig_* here.
+        m_early_delays[0].process(early_left, sig_left, n);
+        m_early_delays[1].process(early_right, sig_right, n);
+
+        process_early_allpass(4, sig_left, sig_left, n, ramp);
+        process_early_allpass(5, sig_left, sig_left, n, ramp);
+        process_early_allpass(6, sig_right, sig_right, n, ramp);
+        process_early_allpass(7, sig_right, sig_right, n, ramp);
+        if (ramp != nullptr) {
+            rotate(sig_left, sig_right, n, rotate_cos, rotate_sin, ramp->rotate_cos, ramp->rotate_sin);
+        } else {
+            rotate(sig_left, sig_right, n, rotate_cos, rotate_sin);
+        }
+        for (int i = 0; i < n; i++) {
+            early_left[i] += sig_left[i] * 0.5f;
+            early_right[i] += sig_right[i] * 0.5f;
+        }
+    }
+
+    inline void process_early_allpass(
+        int j, const float* in, float* out, int n, const SmoothedCoefficients* ramp
+    ) {
+        if (ramp != nullptr) {
+            m_early_allpasses[j].process(in, out, n, ramp->early_allpass_k[j]);
+        } else {
+            m_early_allpasses[j].process(in, out, n);
+        }
     }
 
-    float process(float in, float offset) {
-        float position = m_read_position - (m_delay + offset) * m_sample_rate;
+    // The four late branches run as the lanes of a Float4. Within a sample
+    // they are independent: the second branch of each side takes its input
+    // from a late delay output, which was written long ago.
+    //
+    // Lane:               0           1           2           3
+    // Input:              feedback[0] delay 0     feedback[1] delay 2
+    //                     + early[0]  + early[0]  + early[1]  + early[1]
+    // Modulation:         -lfo[0]     -lfo[1]     lfo[0]      lfo[1]
+    //
+    // With a modulation depth of 0 the variable allpasses read the nearest
+    // whole sample instead, like the fixed ones, and the LFO is left alone.
+    // Switching between the two crossfades their outputs, so that neither the
+    // jump to the integer delay nor the LFO starting up again clicks.
+    //
+    // All of this runs at m_late_sample_rate.
+    inline void process_late(
+        const float* early_left,
+        const float* early_right,
+        int n,
+        float k,
+        float rotate_cos,
+        float rotate_sin,
+        const SmoothedCoefficients* ramp
+    ) {
+        if (ramp != nullptr) {
+            process_late_ramped<true>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        } else {
+            process_late_ramped<false>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        }
+    }
 
-        // This catches a very sneaky bug -- casting position to int rounds
-        // toward zero. To mitigate this, we ensure that the position is always
-        // above zero before rounding it down, using the fact that
-        // (m_delay + offset) * m_sample_rate < m_size.
-        position += m_size;
+    template <bool Ramped>
+    inline void process_late_ramped(
+        const float* early_left,
+        const float* early_right,
+        int n,
+        float k,
+        float rotate_cos,
+        float rotate_sin,
+        const SmoothedCoefficients* ramp
+    ) {
+        if (m_buffer_mode == BufferMode::exact) {
+            process_late_wrapped<ExactWrap, Ramped>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        } else {
+            process_late_wrapped<PowerOfTwoWrap, Ramped>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        }
+    }
 
-        int iposition = position;
-        float position_frac = position - iposition;
+    template <class Wrap, bool Ramped>
+    inline void process_late_wrapped(
+        const float* early_left,
+        const float* early_right,
+        int n,
+        float k,
+        float rotate_cos,
+        float rotate_sin,
+        const SmoothedCoefficients* ramp
+    ) {
+        if (m_unmodulated_mix != m_unmodulated_target) {
+            process_late_path<Wrap, LatePath::fading, Ramped>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        } else if (m_unmodulated_mix == 1.0f) {
+            process_late_path<Wrap, LatePath::unmodulated, Ramped>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        } else {
+            process_late_path<Wrap, LatePath::modulated, Ramped>(early_left, early_right, n, k, rotate_cos, rotate_sin, ramp);
+        }
+    }
 
-        float y0 = m_buffer[iposition & m_mask];
-        float y1 = m_buffer[(iposition + 1) & m_mask];
-        float y2 = m_buffer[(iposition + 2) & m_mask];
-        float y3 = m_buffer[(iposition + 3) & m_mask];
+    // If Ramped, ramp holds the amounts to add to the coefficients after
+    // each sample, see process_chunk_ramped.
+    template <class Wrap, LatePath Path, bool Ramped>
+    inline void process_late_path(
+        const float* early_left,
+        const float* early_right,
+        int n,
+        float k,
+        float rotate_cos,
+        float rotate_sin,
+        const SmoothedCoefficients* ramp
+    ) {
+        const bool modulated = Path != LatePath::unmodulated;
+
+        // At audio rate, the LFO is evaluated for every sample. At control
+        // rate, it is evaluated once every m_mod_control_period samples and
+        // the modulated delays ramp linearly towards the next value.
+        const bool control_rate = m_mod_control_period > 1;
+        float lfo_sin[k_max_chunk_size];
+        float lfo_cos[k_max_chunk_size];
+        if (modulated && !control_rate) {
+            m_lfo.process(lfo_sin, lfo_cos, n);
+        }
 
-        float delayed_signal = interpolate_cubic(position_frac, y0, y1, y2, y3);
+        LaneBuffers<Wrap> variable_allpasses = load_lanes<Wrap>(m_late_variable_allpasses);
+        LaneBuffers<Wrap> allpasses = load_lanes<Wrap>(m_late_allpasses);
+        LaneBuffers<Wrap> delays = load_lanes<Wrap>(m_late_delays);
 
-        float feedback_plus_input = in + delayed_signal * m_k;
-        m_buffer[m_read_position] = flush_denormals(feedback_plus_input);
-        m_read_position = (m_read_position + 1) & m_mask;
-        float out = feedback_plus_input * -m_k + delayed_signal;
+        Float4 variable_allpass_k;
+        Float4 variable_allpass_delay;
+        Float4 allpass_k;
+        float lane_values[4];
+        for (int j = 0; j < 4; j++) {
+            lane_values[j] = m_late_variable_allpasses[j].m_k;
+        }
+        variable_allpass_k = Float4::load(lane_values);
+        for (int j = 0; j < 4; j++) {
+            lane_values[j] = m_late_variable_allpasses[j].m_delay;
+        }
+        variable_allpass_delay = Float4::load(lane_values);
+        for (int j = 0; j < 4; j++) {
+            lane_values[j] = m_late_variable_allpasses[j].m_interpolation_state;
+        }
+        Float4 interpolation_state = Float4::load(lane_values);
+        for (int j = 0; j < 4; j++) {
+            lane_values[j] = m_late_allpasses[j].m_k;
+        }
+        allpass_k = Float4::load(lane_values);
+        const Float4 variable_allpass_size = Float4::load(variable_allpasses.size);
+        const Float4 sample_rate(m_late_sample_rate);
+        Float4 k4(k);
+
+        BiquadLanes damping = load_biquad_lanes(m_damping);
+        Float4 damping_s1 = Float4::load(m_damping_s1);
+        Float4 damping_s2 = Float4::load(m_damping_s2);
+        const bool dc_blocker = m_dc_blocker;
+        const Float4 dc_blocker_k(m_dc_blocker_k);
+        const Float4 dc_blocker_gain(0.5f * (1.0f + m_dc_blocker_k));
+        Float4 dc_blocker_x1 = Float4::load(m_dc_blocker_x1);
+        Float4 dc_blocker_y1 = Float4::load(m_dc_blocker_y1);
+
+        Float4 k_step;
+        Float4 variable_allpass_k_step;
+        Float4 allpass_k_step;
+        BiquadLanes damping_step;
+        if (Ramped) {
+            k_step = Float4(ramp->k);
+            variable_allpass_k_step = Float4::load(ramp->variable_allpass_k);
+            allpass_k_step = Float4::load(ramp->allpass_k);
+            damping_step = load_biquad_lanes(ramp->damping);
+        }
 
-        return out;
-    }
+        Stereo feedback = m_feedback;
+
+        Float4 modulation;
+        Float4 modulation_step;
+        int mod_control_timeout = m_mod_control_timeout;
+        if (modulated && control_rate) {
+            if (m_mod_control_restart) {
+                Stereo value = m_lfo.advance(0);
+                Float4 offset(-value[0], -value[1], value[0], value[1]);
+                (offset * sample_rate).store(m_modulation);
+                mod_control_timeout = 0;
+                m_mod_control_restart = false;
+            }
+            modulation = Float4::load(m_modulation);
+            modulation_step = Float4::load(m_modulation_step);
+        }
+        const Float4 variable_allpass_delay_in_samples = variable_allpass_delay * sample_rate;
+        const Float4 mod_control_step_scale(1.0f / m_mod_control_period);
+
+        // The nearest whole sample to where the modulated path reads with no
+        // offset, which is one sample after position - delay.
+        int unmodulated_offsets[4];
+        for (int j = 0; j < 4; j++) {
+            unmodulated_offsets[j] = m_late_variable_allpasses[j].m_delay * m_late_sample_rate - 0.5f;
+        }
+        float unmodulated_mix = m_unmodulated_mix;
+        const float unmodulated_target = m_unmodulated_target;
+        const float fade_step = 1.0f / (k_modulation_fade_time * m_late_sample_rate);
+
+        for (int i = 0; i < n; i++) {
+            // Late delay outputs, damped by both shelves at once.
+            Float4 delayed = delays.read(delays.delay);
+            Float4 damped = damping.b0 * delayed + damping_s1;
+            damping_s1 = damping.b1 * delayed - damping.a1 * damped + damping_s2;
+            damping_s2 = damping.b2 * delayed - damping.a2 * damped;
+            if (dc_blocker) {
+                // A one-pole highpass, scaled to unity gain at Nyquist so
+                // that it never boosts anything on its way around the loop.
+                Float4 y = dc_blocker_gain * (damped - dc_blocker_x1) + dc_blocker_k * dc_blocker_y1;
+                dc_blocker_x1 = damped;
+                dc_blocker_y1 = y;
+                damped = y;
+            }
+            float damped_values[4];
+            damped.store(damped_values);
+
+            Float4 sig(
+                feedback[0] + early_left[i],
+                damped_values[0] + early_left[i],
+                feedback[1] + early_right[i],
+                damped_values[2] + early_right[i]
+            );
+
+            Stereo late = {{damped_values[1], damped_values[3]}};
+            late = rotate(late, rotate_cos, rotate_sin);
+            feedback = flush_denormals(late);
+
+            // Modulated allpasses.
+            Float4 delayed_signal_modulated;
+            if (modulated) {
+                Float4 position = Float4::load(variable_allpasses.position);
+                if (control_rate) {
+                    if (mod_control_timeout <= 0) {
+                        Stereo value = m_lfo.advance(m_mod_control_period);
+                        Float4 offset(-value[0], -value[1], value[0], value[1]);
+                        modulation_step = (offset * sample_rate - modulation) * mod_control_step_scale;
+                        mod_control_timeout = m_mod_control_period;
+                    }
+                    mod_control_timeout -= 1;
+                    modulation = modulation + modulation_step;
+                    position = position - (variable_allpass_delay_in_samples + modulation);
+                } else {
+                    Float4 offset(-lfo_sin[i], -lfo_cos[i], lfo_sin[i], lfo_cos[i]);
+                    position = position - (variable_allpass_delay + offset) * sample_rate;
+                }
+                // See VariableAllpass::process.
+                position = position + variable_allpass_size;
+
+                int iposition[4];
+                Float4 position_frac = position - position.truncate(iposition);
+
+                Float4 y[Interpolation::k_taps];
+                for (int t = 0; t < Interpolation::k_taps; t++) {
+                    y[t] = variable_allpasses.gather(iposition, Interpolation::k_first_tap + t);
+                }
+                delayed_signal_modulated =
+                    Interpolation::interpolate(position_frac, y, interpolation_state);
+            }
+            {
+                Float4 delayed_signal;
+                if (Path == LatePath::modulated) {
+                    delayed_signal = delayed_signal_modulated;
+                } else if (Path == LatePath::unmodulated) {
+                    delayed_signal = variable_allpasses.read(unmodulated_offsets);
+                } else {
+                    if (unmodulated_mix < unmodulated_target) {
+                        unmodulated_mix = std::min(unmodulated_mix + fade_step, unmodulated_target);
+                    } else {
+                        unmodulated_mix = std::max(unmodulated_mix - fade_step, unmodulated_target);
+                    }
+                    Float4 delayed_signal_unmodulated = variable_allpasses.read(unmodulated_offsets);
+                    delayed_signal = delayed_signal_modulated
+                        + (delayed_signal_unmodulated - delayed_signal_modulated) * Float4(unmodulated_mix);
+                }
+
+                Float4 feedback_plus_input = sig + delayed_signal * variable_allpass_k;
+                variable_allpasses.write(flush_denormals(feedback_plus_input));
+                sig = feedback_plus_input * -variable_allpass_k + delayed_signal;
+            }
 
-private:
-    float m_diffusion_sign;
-};
+            // Fixed allpasses.
+            {
+                Float4 delayed_signal = allpasses.read(allpasses.delay);
+                Float4 feedback_plus_input = sig + delayed_signal * allpass_k;
+                allpasses.write(flush_denormals(feedback_plus_input));
+                sig = feedback_plus_input * -allpass_k + delayed_signal;
+            }
 
-template <class Alloc = Allocator>
-class NHHall {
-public:
-    float m_k;
-    bool m_initialization_was_successful;
+            sig = sig * k4;
+            delays.write(sig);
+
+            if (Ramped) {
+                k4 = k4 + k_step;
+                variable_allpass_k = variable_allpass_k + variable_allpass_k_step;
+                allpass_k = allpass_k + allpass_k_step;
+                damping.b0 = damping.b0 + damping_step.b0;
+                damping.b1 = damping.b1 + damping_step.b1;
+                damping.b2 = damping.b2 + damping_step.b2;
+                damping.a1 = damping.a1 + damping_step.a1;
+                damping.a2 = damping.a2 + damping_step.a2;
+                rotate_cos += ramp->rotate_cos;
+                rotate_sin += ramp->rotate_sin;
+            }
+        }
 
-    NHHall(
-        float sample_rate,
-        std::unique_ptr<Alloc> allocator
-    ) :
-    m_sample_rate(sample_rate),
-    m_allocator(std::move(allocator)),
-
-    m_lfo(sample_rate),
-    m_dc_blocker(sample_rate),
-
-    m_low_shelves {{sample_rate, sample_rate, sample_rate, sample_rate}},
-    m_hi_shelves {{sample_rate, sample_rate, sample_rate, sample_rate}},
-
-    m_early_allpasses {{
-        Allpass(sample_rate, 9.5e-3f, 1),
-        Allpass(sample_rate, 12.0e-3f, -1),
-        Allpass(sample_rate, 7.8e-3f, 1),
-        Allpass(sample_rate, 14.2e-3f, -1),
-        Allpass(sample_rate, 23.5e-3f, 1),
-        Allpass(sample_rate, 8.0e-3f, -1),
-        Allpass(sample_rate, 25.8e-3f, 1),
-        Allpass(sample_rate, 7.2e-3f, -1)
-    }},
+        m_feedback = feedback;
+        m_unmodulated_mix = unmodulated_mix;
+        interpolation_state.store(lane_values);
+        for (int j = 0; j < 4; j++) {
+            m_late_variable_allpasses[j].m_interpolation_state = lane_values[j];
+        }
+        if (modulated && control_rate) {
+            modulation.store(m_modulation);
+            modulation_step.store(m_modulation_step);
+            m_mod_control_timeout = mod_control_timeout;
+        }
 
-    m_early_delays {{
-        Delay(sample_rate, 5.45e-3),
-        Delay(sample_rate, 3.25e-3),
-        Delay(sample_rate, 2.36e-3),
-        Delay(sample_rate, 7.17e-3)
-    }},
+        store_lanes(m_late_variable_allpasses, variable_allpasses, n);
+        store_lanes(m_late_allpasses, allpasses, n);
+        store_lanes(m_late_delays, delays, n);
+        flush_denormals(damping_s1).store(m_damping_s1);
+        flush_denormals(damping_s2).store(m_damping_s2);
+        dc_blocker_x1.store(m_dc_blocker_x1);
+        flush_denormals(dc_blocker_y1).store(m_dc_blocker_y1);
+    }
 
-    m_late_variable_allpasses {{
-        VariableAllpass(sample_rate, 25.6e-3f, RandomLFO::k_max_amplitude, 1),
-        VariableAllpass(sample_rate, 50.7e-3f, RandomLFO::k_max_amplitude, -1),
-        VariableAllpass(sample_rate, 68.6e-3f, RandomLFO::k_max_amplitude, 1),
-        VariableAllpass(sample_rate, 45.7e-3f, RandomLFO::k_max_amplitude, -1)
-    }},
+    // Buffers and positions of four delay units, one per Float4 lane.
+    template <class Wrap>
+    struct LaneBuffers {
+        typename Storage::Sample* buffer[4];
+        Wrap wrap[4];
+        int position[4];
+        int delay[4];
+        int size[4];
+
+        // Read each lane's buffer at (position - offset).
+        inline Float4 read(const int* offset) const {
+            return Float4(
+                Storage::load(buffer[0][wrap[0].wrap(position[0] - offset[0])]),
+                Storage::load(buffer[1][wrap[1].wrap(position[1] - offset[1])]),
+                Storage::load(buffer[2][wrap[2].wrap(position[2] - offset[2])]),
+                Storage::load(buffer[3][wrap[3].wrap(position[3] - offset[3])])
+            );
+        }
 
-    m_late_allpasses {{
-        Allpass(sample_rate, 41.4e-3f, -1),
-        Allpass(sample_rate, 25.6e-3f, 1),
-        Allpass(sample_rate, 29.4e-3f, -1),
-        Allpass(sample_rate, 23.6e-3f, 1)
-    }},
+        // Read each lane's buffer at index[j] + offset, which must be in
+        // [0, 2 * size[j]).
+        inline Float4 gather(const int* index, int offset) const {
+            return Float4(
+                Storage::load(buffer[0][wrap[0].wrap_above(index[0] + offset)]),
+                Storage::load(buffer[1][wrap[1].wrap_above(index[1] + offset)]),
+                Storage::load(buffer[2][wrap[2].wrap_above(index[2] + offset)]),
+                Storage::load(buffer[3][wrap[3].wrap_above(index[3] + offset)])
+            );
+        }
 
-    m_late_delays {{
-        Delay(sample_rate, k_delay_time_1),
-        Delay(sample_rate, k_delay_time_2),
-        Delay(sample_rate, k_delay_time_3),
-        Delay(sample_rate, k_delay_time_4)
-    }}
+        // Write at the current positions and advance them.
+        inline void write(Float4 x) {
+            float values[4];
+            x.store(values);
+            for (int j = 0; j < 4; j++) {
+                buffer[j][position[j]] = Storage::store(values[j]);
+                position[j] = wrap[j].wrap_above(position[j] + 1);
+            }
+        }
+    };
 
-    {
-        m_k = 0.0f;
+    struct BiquadLanes {
+        Float4 b0;
+        Float4 b1;
+        Float4 b2;
+        Float4 a1;
+        Float4 a2;
+    };
 
-        m_initialization_was_successful = allocate_delay_lines();
+    template <class Wrap, class Unit>
+    static LaneBuffers<Wrap> load_lanes(std::array<Unit, 4>& units) {
+        LaneBuffers<Wrap> lanes;
+        for (int j = 0; j < 4; j++) {
+            lanes.buffer[j] = units[j].m_buffer;
+            lanes.wrap[j] = Wrap(units[j].m_size);
+            lanes.position[j] = units[j].m_read_position;
+            lanes.delay[j] = units[j].m_delay_in_samples;
+            lanes.size[j] = units[j].m_size;
+        }
+        return lanes;
     }
 
-    // If no allocator object is passed in, we try to make one ourselves by
-    // calling the constructor with no arguments.
-    NHHall(
-        float sample_rate
-    ) :
-    NHHall(sample_rate, std::unique_ptr<Alloc>(new Alloc()))
-    { }
-
-    ~NHHall() {
-        free_delay_lines();
+    // The units have been written n samples since load_lanes.
+    template <class Wrap, class Unit>
+    static void store_lanes(std::array<Unit, 4>& units, const LaneBuffers<Wrap>& lanes, int n) {
+        for (int j = 0; j < 4; j++) {
+            units[j].m_read_position = lanes.position[j];
+            units[j].mark_written(n);
+        }
     }
 
-    inline float compute_k_from_rt60(float rt60) {
-        return powf(0.001f, k_average_delay_time / rt60);
+    static BiquadLanes load_biquad_lanes(const Biquad& biquad) {
+        BiquadLanes lanes;
+        lanes.b0 = Float4(biquad.b0);
+        lanes.b1 = Float4(biquad.b1);
+        lanes.b2 = Float4(biquad.b2);
+        lanes.a1 = Float4(biquad.a1);
+        lanes.a2 = Float4(biquad.a2);
+        return lanes;
     }
 
-    inline void set_rt60(float rt60) {
-        m_k = compute_k_from_rt60(rt60);
+    inline void process_outputs(
+        const float* early_left,
+        const float* early_right,
+        float* out_left,
+        float* out_right,
+        int n
+    ) {
+        for (int i = 0; i < n; i++) {
+            out_left[i] = early_left[i] * 0.5f;
+            out_right[i] = early_right[i] * 0.5f;
+        }
+        add_taps(out_left, out_right, n);
     }
 
-    inline void set_stereo(float stereo) {
-        float angle = stereo * twopi * 0.25f;
-        m_rotate_cos = cosf(angle);
-        m_rotate_sin = sinf(angle);
+    // Add the output taps on the last n samples of the late delays.
+    inline void add_taps(float* out_left, float* out_right, int n) {
+        std::array<OutputTap, 8> taps = get_output_taps();
+        for (int j = 0; j < 8; j++) {
+            float* out = taps[j].channel == 0 ? out_left : out_right;
+            add_tap(out, m_late_delays[taps[j].delay], m_output_tap_offsets[j], taps[j].gain, n);
+        }
     }
 
-    inline void set_low_shelf_parameters(float frequency, float ratio) {
-        float k = powf(m_k, 1.0f / ratio - 1.0f);
-        k = std::max(k, 0.01f);
-        for (auto& x : m_low_shelves) {
-            x.set_parameters(frequency, k);
+    inline void add_tap(float* out, Delay<Storage>& delay, int offset, float gain, int n) {
+        float tap[k_max_chunk_size];
+        delay.tap_samples(tap, n, offset);
+        for (int i = 0; i < n; i++) {
+            out[i] += tap[i] * gain;
         }
     }
+};
 
-    inline void set_hi_shelf_parameters(float frequency, float ratio) {
-        float k = powf(m_k, 1.0f / ratio - 1.0f);
-        k = std::max(k, 0.01f);
-        for (auto& x : m_hi_shelves) {
-            x.set_parameters(frequency, k);
+template <class Alloc, class Storage, class Interpolation>
+constexpr float NHHall<Alloc, Storage, Interpolation>::k_early_allpass_times[8];
+template <class Alloc, class Storage, class Interpolation>
+constexpr float NHHall<Alloc, Storage, Interpolation>::k_early_delay_times[4];
+template <class Alloc, class Storage, class Interpolation>
+constexpr float NHHall<Alloc, Storage, Interpolation>::k_late_variable_allpass_times[4];
+template <class Alloc, class Storage, class Interpolation>
+constexpr float NHHall<Alloc, Storage, Interpolation>::k_late_allpass_times[4];
+template <class Alloc, class Storage, class Interpolation>
+constexpr float NHHall<Alloc, Storage, Interpolation>::k_late_delay_times[4];
+
+// M NHHall voices built in place in a single allocation, to be handed out and
+// taken back without touching the allocator again. Every voice has auto sleep
+// on. A voice that has been released keeps ringing until it falls asleep,
+// and only then is it free; when no voice is free, acquire() steals the one
+// with the shortest tail, preferring released voices over held ones.
+template <
+    int M,
+    class Alloc = Allocator,
+    class Storage = FloatStorage,
+    class Interpolation = CubicInterpolation
+>
+class NHHallPool {
+    static_assert(M > 0, "NHHallPool needs at least one voice");
+
+public:
+    // The voices live in the pool's allocation, so they don't get a copy of
+    // its allocator, which then need not be copyable.
+    typedef NHHall<NullAllocator, Storage, Interpolation> Voice;
+
+    bool m_initialization_was_successful;
+
+    NHHallPool(
+        float sample_rate,
+        Alloc allocator,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) :
+    m_slab(std::move(allocator))
+    {
+        int stride = get_stride(sample_rate, buffer_mode, late_rate, max_predelay);
+        for (int i = 0; i < M; i++) {
+            m_voices[i] = nullptr;
+            m_states[i] = VoiceState::free;
+        }
+        int bytes = get_pool_bytes(stride);
+        m_slab.m_memory = bytes < 0 ? nullptr : m_slab.m_allocator.allocate(bytes);
+        m_initialization_was_successful = m_slab.m_memory != nullptr;
+        for (int i = 0; i < M && m_initialization_was_successful; i++) {
+            m_voices[i] = Voice::create_in_place(
+                static_cast<char*>(m_slab.m_memory) + i * stride,
+                stride,
+                sample_rate,
+                buffer_mode,
+                late_rate,
+                max_predelay
+            );
+            if (m_voices[i] == nullptr || !m_voices[i]->m_initialization_was_successful) {
+                m_initialization_was_successful = false;
+                break;
+            }
+            m_voices[i]->set_auto_sleep(true);
         }
     }
 
-    inline void set_early_diffusion(float diffusion) {
-        for (auto& x : m_early_allpasses) {
-            x.set_diffusion(diffusion);
+    NHHallPool(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) :
+    NHHallPool(sample_rate, Alloc(), buffer_mode, late_rate, max_predelay)
+    { }
+
+    ~NHHallPool() {
+        for (Voice* voice : m_voices) {
+            if (voice != nullptr) {
+                voice->~Voice();
+            }
         }
     }
 
-    inline void set_late_diffusion(float diffusion) {
-        for (auto& x : m_late_allpasses) {
-            x.set_diffusion(diffusion);
-        }
-        for (auto& x : m_late_variable_allpasses) {
-            x.set_diffusion(diffusion);
+    // The voices point into the pool's allocation.
+    NHHallPool(const NHHallPool&) = delete;
+    NHHallPool& operator=(const NHHallPool&) = delete;
+
+    // The number of bytes the constructor will request from the allocator,
+    // in a single allocate() call, or -1 if that is more than an int holds,
+    // in which case initialization fails.
+    static constexpr int required_bytes(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two,
+        LateRate late_rate = LateRate::full,
+        float max_predelay = 0.0f
+    ) {
+        return get_pool_bytes(get_stride(sample_rate, buffer_mode, late_rate, max_predelay));
+    }
+
+    // Settings made on a voice survive it being released, acquired and
+    // stolen; only its state is reset.
+    inline Voice& voice(int index) {
+        return *m_voices[index];
+    }
+
+    // Hand out a voice, silenced, and return its index. Never fails: when
+    // all voices are busy, the one with the least tail left is stolen, and
+    // whoever held it before must stop using it.
+    int acquire(void) {
+        int best = -1;
+        int best_tail = 0;
+        bool best_held = true;
+        for (int i = 0; i < M; i++) {
+            if (m_states[i] == VoiceState::released && m_voices[i]->is_sleeping()) {
+                m_states[i] = VoiceState::free;
+            }
+            if (m_states[i] == VoiceState::free) {
+                best = i;
+                break;
+            }
+            bool held = m_states[i] == VoiceState::held;
+            int tail = m_voices[i]->tail_remaining_samples();
+            if (best == -1 || (best_held && !held) || (best_held == held && tail < best_tail)) {
+                best = i;
+                best_tail = tail;
+                best_held = held;
+            }
         }
+        m_voices[best]->reset();
+        m_states[best] = VoiceState::held;
+        return best;
     }
 
-    inline void set_mod_rate(float mod_rate) {
-        m_lfo.set_rate(mod_rate);
+    // Let the voice ring out. It is free again once it has fallen asleep.
+    void release(int index) {
+        m_states[index] = VoiceState::released;
     }
 
-    inline void set_mod_depth(float mod_depth) {
-        m_lfo.set_depth(mod_depth);
+    // Whether the voice is held, as opposed to released or free.
+    bool is_held(int index) const {
+        return m_states[index] == VoiceState::held;
     }
 
-    inline void seed(uint32_t seed) {
-        m_lfo.seed(seed);
+    // Whether the voice needs processing: held, or released and still
+    // ringing. Processing the others is harmless but produces silence.
+    bool is_active(int index) const {
+        return m_states[index] == VoiceState::held
+            || (m_states[index] == VoiceState::released && !m_voices[index]->is_sleeping());
     }
 
-    Stereo process(Stereo in) {
-        Stereo lfo = m_lfo.process();
+private:
+    enum class VoiceState { free, held, released };
+
+    OwnedSlab<Alloc> m_slab;
+    std::array<Voice*, M> m_voices;
+    std::array<VoiceState, M> m_states;
+
+    // Each voice with its delay lines, rounded up to whole cache lines.
+    static constexpr int get_stride(
+        float sample_rate, BufferMode buffer_mode, LateRate late_rate, float max_predelay
+    ) {
+        return Voice::get_slab_stride(
+            Voice::required_bytes_in_place(sample_rate, buffer_mode, late_rate, max_predelay)
+        );
+    }
 
-        Stereo early = process_early(in);
+    // M voices of stride bytes, or -1 if that overflows an int.
+    static constexpr int get_pool_bytes(int stride) {
+        return stride > std::numeric_limits<int>::max() / M ? -1 : M * stride;
+    }
+};
 
-        Stereo out = process_outputs(early);
 
-        Stereo late = {{
-            process_late_left(early[0], lfo),
-            process_late_right(early[1], lfo)
-        }};
-        late = rotate(late, m_rotate_cos, m_rotate_sin);
-        m_feedback = flush_denormals(late);
+// One delay unit for every lane of an NHHallBank. All lanes run at the same
+// sample rate, so they share a length and a read position, and their
+// buffers are interleaved: sample t of lane l is at m_buffer[t * N + l]. One
+// read or write then covers all lanes with a single contiguous access.
+template <int N>
+class BankDelay {
+public:
+    float* m_buffer = nullptr;
+    int m_size;
+    int m_read_position = 0;
+    int m_delay_in_samples;
+    float m_delay;
+    float m_diffusion_sign = 1.0f;
+    float m_k[N];
+
+    // Copy the geometry of a scalar unit.
+    void init(const BaseDelay<>& unit) {
+        m_size = unit.m_size;
+        m_delay_in_samples = unit.m_delay_in_samples;
+        m_delay = unit.m_delay;
+        for (int lane = 0; lane < N; lane++) {
+            m_k[lane] = 0.5f;
+        }
+    }
 
-        return out;
+    void init(const Allpass<>& unit) {
+        init(static_cast<const BaseDelay<>&>(unit));
+        m_diffusion_sign = unit.m_diffusion_sign;
     }
 
-    Stereo process(float in_left, float in_right) {
-        Stereo in = {{in_left, in_right}};
-        return process(in);
+    void init(const VariableAllpass<>& unit) {
+        init(static_cast<const BaseDelay<>&>(unit));
+        m_diffusion_sign = unit.m_diffusion_sign;
     }
 
-private:
-    static constexpr float k_delay_time_1 = 153.6e-3f;
-    static constexpr float k_delay_time_2 = 94.3e-3f;
-    static constexpr float k_delay_time_3 = 187.6e-3f;
-    static constexpr float k_delay_time_4 = 123.6e-3f;
+    void set_diffusion(int lane, float diffusion) {
+        m_k[lane] = diffusion * m_diffusion_sign;
+    }
 
-    static constexpr float k_average_delay_time =
-        (k_delay_time_1 + k_delay_time_2 + k_delay_time_3 + k_delay_time_4) / 4.0f;
+    // See BaseDelay::wrap.
+    inline int wrap(int index) const {
+        return index + (-(index < 0) & m_size);
+    }
 
-    std::unique_ptr<Alloc> m_allocator;
+    // The row at a position in [-m_size, m_size).
+    inline float* row(int position) {
+        return m_buffer + wrap(position) * N;
+    }
 
-    const float m_sample_rate;
+    inline void advance(void) {
+        m_read_position = wrap(m_read_position + 1 - m_size);
+    }
 
-    Stereo m_feedback = {{0.f, 0.f}};
+    // Fixed delay line, see Delay::process.
+    inline void process_delay(float* sig) {
+        const float* read = row(m_read_position - m_delay_in_samples);
+        float* write = row(m_read_position);
+        for (int lane = 0; lane < N; lane += 4) {
+            Float4 delayed_signal = Float4::load(read + lane);
+            Float4::load(sig + lane).store(write + lane);
+            delayed_signal.store(sig + lane);
+        }
+        advance();
+    }
 
-    float m_rotate_cos = 0.0f;
-    float m_rotate_sin = 1.0f;
+    // Schroeder allpass, see Allpass::process.
+    inline void process_allpass(float* sig) {
+        const float* read = row(m_read_position - m_delay_in_samples);
+        float* write = row(m_read_position);
+        for (int lane = 0; lane < N; lane += 4) {
+            Float4 delayed_signal = Float4::load(read + lane);
+            Float4 k = Float4::load(m_k + lane);
+            Float4 feedback_plus_input = Float4::load(sig + lane) + delayed_signal * k;
+            flush_denormals(feedback_plus_input).store(write + lane);
+            (feedback_plus_input * -k + delayed_signal).store(sig + lane);
+        }
+        advance();
+    }
 
-    RandomLFO m_lfo;
-    DCBlocker m_dc_blocker;
+    // Modulated allpass, see VariableAllpass::process. Every lane has its own
+    // fractional read position, so the reads are gathers.
+    inline void process_variable_allpass(float* sig, const float* offset, float offset_sign, float sample_rate) {
+        const Float4 read_position(static_cast<float>(m_read_position));
+        const Float4 delay(m_delay);
+        const Float4 sign(offset_sign);
+        const Float4 sample_rate4(sample_rate);
+        const Float4 size(static_cast<float>(m_size));
+        float* write = row(m_read_position);
+        for (int lane = 0; lane < N; lane += 4) {
+            Float4 position = read_position
+                - (delay + Float4::load(offset + lane) * sign) * sample_rate4;
+            position = position + size;
+
+            int iposition[4];
+            Float4 position_frac = position - position.truncate(iposition);
+
+            Float4 y[4];
+            for (int tap = 0; tap < 4; tap++) {
+                float values[4];
+                for (int j = 0; j < 4; j++) {
+                    values[j] = row(iposition[j] + tap - m_size)[lane + j];
+                }
+                y[tap] = Float4::load(values);
+            }
+            Float4 delayed_signal = interpolate_cubic(position_frac, y[0], y[1], y[2], y[3]);
+
+            Float4 k = Float4::load(m_k + lane);
+            Float4 feedback_plus_input = Float4::load(sig + lane) + delayed_signal * k;
+            flush_denormals(feedback_plus_input).store(write + lane);
+            (feedback_plus_input * -k + delayed_signal).store(sig + lane);
+        }
+        advance();
+    }
+};
 
-    std::array<LowShelf, 4> m_low_shelves;
-    std::array<HiShelf, 4> m_hi_shelves;
+// N independent reverbs with their own parameters, stored as structure of
+// arrays and processed together: each step of the network runs across all
+// lanes at once, four lanes per Float4. Every lane produces the same output as
+// a standalone NHHall with the same settings, damping included: the shelves
+// of a lane are worked out again at the start of each block in which its m_k
+// or its shelf settings changed, as in NHHall::update_shelves. All lanes
+// share one sample rate, and N must be a multiple of 4.
+//
+// The parameter setters are those of NHHall with an extra lane argument.
+template <int N, class Alloc = Allocator>
+class NHHallBank {
+    static_assert(N % 4 == 0, "NHHallBank needs a multiple of 4 lanes");
 
-    // NOTE: When adding new delay units, don't forget to allocate the memory
-    // in the constructor and free it in the destructor.
-    std::array<Allpass, 8> m_early_allpasses;
-    std::array<Delay, 4> m_early_delays;
+public:
+    float m_k[N];
+    bool m_initialization_was_successful;
 
-    std::array<VariableAllpass, 4> m_late_variable_allpasses;
-    std::array<Allpass, 4> m_late_allpasses;
-    std::array<Delay, 4> m_late_delays;
+    NHHallBank(
+        float sample_rate,
+        Alloc allocator,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) :
+    m_sample_rate(sample_rate),
+    m_slab(std::move(allocator))
+    {
+        typedef NHHall<Alloc> Scalar;
 
-    bool allocate_delay_lines() {
-        for (auto& x : m_early_allpasses) {
-            bool success = allocate_delay_line(x);
-            if (!success) {
-                return false;
-            }
-        }
-        for (auto& x : m_early_delays) {
-            bool success = allocate_delay_line(x);
-            if (!success) {
-                return false;
-            }
+        std::array<Allpass<>, 8> early_allpasses =
+            Scalar::make_early_allpasses(sample_rate, buffer_mode);
+        for (int j = 0; j < 8; j++) {
+            m_early_allpasses[j].init(early_allpasses[j]);
         }
-        for (auto& x : m_late_variable_allpasses) {
-            bool success = allocate_delay_line(x);
-            if (!success) {
-                return false;
-            }
+        std::array<Delay<>, 4> early_delays = Scalar::make_early_delays(sample_rate, buffer_mode);
+        std::array<VariableAllpass<>, 4> late_variable_allpasses =
+            Scalar::make_late_variable_allpasses(sample_rate, buffer_mode);
+        std::array<Allpass<>, 4> late_allpasses = Scalar::make_late_allpasses(sample_rate, buffer_mode);
+        std::array<Delay<>, 4> late_delays = Scalar::make_late_delays(sample_rate, buffer_mode);
+        for (int j = 0; j < 4; j++) {
+            m_early_delays[j].init(early_delays[j]);
+            m_late_variable_allpasses[j].init(late_variable_allpasses[j]);
+            m_late_allpasses[j].init(late_allpasses[j]);
+            m_late_delays[j].init(late_delays[j]);
         }
-        for (auto& x : m_late_allpasses) {
-            bool success = allocate_delay_line(x);
-            if (!success) {
-                return false;
-            }
+
+        std::array<typename Scalar::OutputTap, 8> taps = Scalar::get_output_taps();
+        for (int j = 0; j < 8; j++) {
+            m_output_taps[j] = taps[j];
+            m_output_tap_offsets[j] = 1 + static_cast<int>(taps[j].time * m_sample_rate);
         }
-        for (auto& x : m_late_delays) {
-            bool success = allocate_delay_line(x);
-            if (!success) {
-                return false;
+
+        // Flat damping until a shelf is set, as in NHHall.
+        for (int lane = 0; lane < N; lane++) {
+            m_k[lane] = 0.0f;
+            m_rotate_cos[lane] = 0.0f;
+            m_rotate_sin[lane] = 1.0f;
+            m_feedback_left[lane] = 0.0f;
+            m_feedback_right[lane] = 0.0f;
+            m_low_shelf_frequency[lane] = 0.0f;
+            m_low_shelf_ratio[lane] = 0.0f;
+            m_hi_shelf_frequency[lane] = 0.0f;
+            m_hi_shelf_ratio[lane] = 0.0f;
+            m_shelf_k[lane] = 0.0f;
+            m_damping_b0[lane] = 1.0f;
+            m_damping_b1[lane] = 0.0f;
+            m_damping_b2[lane] = 0.0f;
+            m_damping_a1[lane] = 0.0f;
+            m_damping_a2[lane] = 0.0f;
+            for (int j = 0; j < 4; j++) {
+                m_damping_s1[j][lane] = 0.0f;
+                m_damping_s2[j][lane] = 0.0f;
             }
+            new (&m_lfo_storage[lane]) RandomLFO(sample_rate);
         }
-        return true;
+
+        m_initialization_was_successful = allocate_delay_lines();
+    }
+
+    // See NHHall.
+    NHHallBank(
+        float sample_rate,
+        std::unique_ptr<Alloc> allocator,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) :
+    NHHallBank(sample_rate, std::move(*allocator), buffer_mode)
+    { }
+
+    NHHallBank(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) :
+    NHHallBank(sample_rate, Alloc(), buffer_mode)
+    { }
+
+    NHHallBank(const NHHallBank&) = delete;
+    NHHallBank& operator=(const NHHallBank&) = delete;
+
+    // See NHHall::required_bytes.
+    static constexpr int required_bytes(
+        float sample_rate,
+        BufferMode buffer_mode = BufferMode::power_of_two
+    ) {
+        return NHHall<Alloc>::get_required_bytes(sample_rate, N, buffer_mode);
+    }
+
+    inline float compute_k_from_rt60(float rt60) {
+        return powf(0.001f, NHHall<Alloc>::k_average_delay_time / rt60);
+    }
+
+    inline void set_rt60(int lane, float rt60) {
+        m_k[lane] = compute_k_from_rt60(rt60);
+    }
+
+    inline void set_stereo(int lane, float stereo) {
+        float angle = stereo * twopi * 0.25f;
+        m_rotate_cos[lane] = cosf(angle);
+        m_rotate_sin[lane] = sinf(angle);
+    }
+
+    // Worked out at the start of the next block, see update_shelves.
+    inline void set_low_shelf_parameters(int lane, float frequency, float ratio) {
+        m_low_shelf_frequency[lane] = frequency;
+        m_low_shelf_ratio[lane] = ratio;
+        m_shelf_k[lane] = std::numeric_limits<float>::quiet_NaN();
+    }
+
+    inline void set_hi_shelf_parameters(int lane, float frequency, float ratio) {
+        m_hi_shelf_frequency[lane] = frequency;
+        m_hi_shelf_ratio[lane] = ratio;
+        m_shelf_k[lane] = std::numeric_limits<float>::quiet_NaN();
     }
 
-    void free_delay_lines() {
+    inline void set_early_diffusion(int lane, float diffusion) {
         for (auto& x : m_early_allpasses) {
-            free_delay_line(x);
-        }
-        for (auto& x : m_early_delays) {
-            free_delay_line(x);
-        }
-        for (auto& x : m_late_variable_allpasses) {
-            free_delay_line(x);
+            x.set_diffusion(lane, diffusion);
         }
+    }
+
+    inline void set_late_diffusion(int lane, float diffusion) {
         for (auto& x : m_late_allpasses) {
-            free_delay_line(x);
+            x.set_diffusion(lane, diffusion);
         }
-        for (auto& x : m_late_delays) {
-            free_delay_line(x);
+        for (auto& x : m_late_variable_allpasses) {
+            x.set_diffusion(lane, diffusion);
         }
     }
 
-    bool allocate_delay_line(BaseDelay& delay) {
-        void* memory = m_allocator->allocate(sizeof(float) * delay.m_size);
-        if (!memory) {
-            return false;
-        }
-        delay.m_buffer = static_cast<float*>(memory);
-        memset(delay.m_buffer, 0, sizeof(float) * delay.m_size);
-        return true;
+    inline void set_mod_rate(int lane, float mod_rate) {
+        lfo(lane).set_rate(mod_rate);
     }
 
-    void free_delay_line(BaseDelay& delay) {
-        if (delay.m_buffer != nullptr) {
-            m_allocator->deallocate(delay.m_buffer);
-        }
+    inline void set_mod_depth(int lane, float mod_depth) {
+        lfo(lane).set_depth(mod_depth);
     }
 
-    inline Stereo process_early(Stereo in) {
-        Stereo sig = {{in[0], in[1]}};
+    inline void set_exact_lfo(int lane, bool exact) {
+        lfo(lane).set_exact(exact);
+    }
 
-        sig[0] = m_early_allpasses[0].process(sig[0]);
-        sig[0] = m_early_allpasses[1].process(sig[0]);
-        sig[1] = m_early_allpasses[2].process(sig[1]);
-        sig[1] = m_early_allpasses[3].process(sig[1]);
-        sig = rotate(sig, m_rotate_cos, m_rotate_sin);
-        Stereo early = sig;
+    // Shared by all lanes, so that they evaluate their LFOs on the same
+    // samples.
+    inline void set_mod_control_period(int period) {
+        m_mod_control_period = std::max(period, 1);
+        m_mod_control_timeout = 0;
+        m_mod_control_restart = true;
+    }
 
-        sig[0] = m_early_delays[0].process(sig[0]);
-        sig[1] = m_early_delays[1].process(sig[1]);
+    inline void seed(int lane, uint32_t seed) {
+        lfo(lane).seed(seed);
+    }
 
-        sig[0] = m_early_allpasses[4].process(sig[0]);
-        sig[0] = m_early_allpasses[5].process(sig[0]);
-        sig[1] = m_early_allpasses[6].process(sig[1]);
-        sig[1] = m_early_allpasses[7].process(sig[1]);
-        sig = rotate(sig, m_rotate_cos, m_rotate_sin);
-        early[0] += sig[0] * 0.5f;
-        early[1] += sig[1] * 0.5f;
+    // Process a block of non-interleaved audio for every lane. in_left[lane]
+    // etc. point to the channel buffers of that lane. As with NHHall, the
+    // outputs may be the same buffers as the inputs.
+    void process_block(
+        const float* const* in_left,
+        const float* const* in_right,
+        float* const* out_left,
+        float* const* out_right,
+        int frames
+    ) {
+#if defined(NH_UGENS_HARDWARE_FTZ)
+        DenormalGuard denormal_guard;
+#endif
+        update_shelves();
+        for (int i = 0; i < frames; i++) {
+            float left[N];
+            float right[N];
+            for (int lane = 0; lane < N; lane++) {
+                left[lane] = in_left[lane][i];
+                right[lane] = in_right[lane][i];
+            }
 
-        return early;
+            process_early(left, right);
+            process_outputs(left, right, i, out_left, out_right);
+            process_late(left, right);
+        }
+        // Once per block, as NHHall does once per chunk.
+        for (int j = 0; j < 4; j++) {
+            for (int lane = 0; lane < N; lane += 4) {
+                flush_denormals(Float4::load(m_damping_s1[j] + lane)).store(m_damping_s1[j] + lane);
+                flush_denormals(Float4::load(m_damping_s2[j] + lane)).store(m_damping_s2[j] + lane);
+            }
+        }
     }
 
-    inline float process_late_left(float early_left, Stereo lfo) {
-        float sig = 0.f;
+private:
+    const float m_sample_rate;
 
-        sig += m_feedback[0];
+    float m_feedback_left[N];
+    float m_feedback_right[N];
+
+    float m_rotate_cos[N];
+    float m_rotate_sin[N];
+
+    // The shelf settings of each lane, and the m_k its damping was worked
+    // out for. NaN, which is never equal, marks a lane whose settings
+    // changed since.
+    float m_low_shelf_frequency[N];
+    float m_low_shelf_ratio[N];
+    float m_hi_shelf_frequency[N];
+    float m_hi_shelf_ratio[N];
+    float m_shelf_k[N];
+
+    // Both shelves as one biquad per lane, see NHHall::get_damping.
+    float m_damping_b0[N];
+    float m_damping_b1[N];
+    float m_damping_b2[N];
+    float m_damping_a1[N];
+    float m_damping_a2[N];
+    float m_damping_s1[4][N];
+    float m_damping_s2[4][N];
+
+    // The LFOs have too little state to be worth vectorizing. RandomLFO has
+    // no default constructor, so they are constructed in place.
+    typename std::aligned_storage<sizeof(RandomLFO), alignof(RandomLFO)>::type m_lfo_storage[N];
+
+    inline RandomLFO& lfo(int lane) {
+        return *reinterpret_cast<RandomLFO*>(&m_lfo_storage[lane]);
+    }
 
-        sig += early_left;
-        sig = m_late_variable_allpasses[0].process(sig, -lfo[0]);
-        sig = m_late_allpasses[0].process(sig);
-        sig *= m_k;
-        sig = m_late_delays[0].process(sig);
-        sig = m_low_shelves[0].process(sig);
-        sig = m_hi_shelves[0].process(sig);
+    // Control-rate modulation, see NHHall::process_late. Ramping the LFO
+    // values linearly ramps the modulated delays linearly.
+    int m_mod_control_period = 1;
+    int m_mod_control_timeout = 0;
+    bool m_mod_control_restart = true;
+    float m_lfo_sin[N];
+    float m_lfo_cos[N];
+    float m_lfo_sin_step[N];
+    float m_lfo_cos_step[N];
 
-        sig += early_left;
-        sig = m_late_variable_allpasses[1].process(sig, -lfo[1]);
-        sig = m_late_allpasses[1].process(sig);
-        sig *= m_k;
-        sig = m_late_delays[1].process(sig);
-        sig = m_low_shelves[1].process(sig);
-        sig = m_hi_shelves[1].process(sig);
+    OwnedSlab<Alloc> m_slab;
 
-        return sig;
-    }
+    std::array<BankDelay<N>, 8> m_early_allpasses;
+    std::array<BankDelay<N>, 4> m_early_delays;
 
-    inline float process_late_right(float early_right, Stereo lfo) {
-        float sig = 0.f;
+    std::array<BankDelay<N>, 4> m_late_variable_allpasses;
+    std::array<BankDelay<N>, 4> m_late_allpasses;
+    std::array<BankDelay<N>, 4> m_late_delays;
 
-        sig += m_feedback[1];
+    std::array<typename NHHall<Alloc>::OutputTap, 8> m_output_taps;
+    int m_output_tap_offsets[8];
 
-        sig += early_right;
-        sig = m_late_variable_allpasses[2].process(sig, lfo[0]);
-        sig = m_late_allpasses[2].process(sig);
-        sig *= m_k;
-        sig = m_late_delays[2].process(sig);
-        sig = m_low_shelves[2].process(sig);
-        sig = m_hi_shelves[2].process(sig);
+    // See NHHall::allocate_delay_lines.
+    bool allocate_delay_lines() {
+        typedef NHHall<Alloc> Scalar;
+        m_slab.m_memory = Scalar::allocate_slab(
+            m_slab.m_allocator,
+            Scalar::template get_processing_order<BankDelay<N>>(
+                m_early_allpasses,
+                m_early_delays,
+                m_late_variable_allpasses,
+                m_late_allpasses,
+                m_late_delays
+            ),
+            N
+        );
+        return m_slab.m_memory != nullptr;
+    }
 
-        sig += early_right;
-        sig = m_late_variable_allpasses[3].process(sig, lfo[1]);
-        sig = m_late_allpasses[3].process(sig);
-        sig *= m_k;
-        sig = m_late_delays[3].process(sig);
-        sig = m_low_shelves[3].process(sig);
-        sig = m_hi_shelves[3].process(sig);
+    // See NHHall::update_shelves.
+    void update_shelves(void) {
+        for (int lane = 0; lane < N; lane++) {
+            if (m_shelf_k[lane] == m_k[lane]) {
+                continue;
+            }
+            typename NHHall<Alloc>::Biquad damping = NHHall<Alloc>::get_damping(
+                m_sample_rate,
+                m_k[lane],
+                m_low_shelf_frequency[lane],
+                m_low_shelf_ratio[lane],
+                m_hi_shelf_frequency[lane],
+                m_hi_shelf_ratio[lane]
+            );
+            m_damping_b0[lane] = damping.b0;
+            m_damping_b1[lane] = damping.b1;
+            m_damping_b2[lane] = damping.b2;
+            m_damping_a1[lane] = damping.a1;
+            m_damping_a2[lane] = damping.a2;
+            m_shelf_k[lane] = m_k[lane];
+        }
+    }
 
-        return sig;
+    inline void rotate_lanes(float* left, float* right) {
+        for (int lane = 0; lane < N; lane += 4) {
+            Float4 x0 = Float4::load(left + lane);
+            Float4 x1 = Float4::load(right + lane);
+            Float4 cos = Float4::load(m_rotate_cos + lane);
+            Float4 sin = Float4::load(m_rotate_sin + lane);
+            (cos * x0 - sin * x1).store(left + lane);
+            (sin * x0 + cos * x1).store(right + lane);
+        }
     }
 
-    inline Stereo process_outputs(Stereo early) {
-        // Keep the inter-channel delays somewhere between 0.1 and 0.7 ms --
-        // this allows the Haas effect to come in.
+    // See NHHall::process_early. Replaces the input with the early signal.
+    inline void process_early(float* left, float* right) {
+        m_early_allpasses[0].process_allpass(left);
+        m_early_allpasses[1].process_allpass(left);
+        m_early_allpasses[2].process_allpass(right);
+        m_early_allpasses[3].process_allpass(right);
+        rotate_lanes(left, right);
+
+        float sig_left[N];
+        float sig_right[N];
+        for (int lane = 0; lane < N; lane++) {
+            sig_left[lane] = left[lane];
+            sig_right[lane] = right[lane];
+        }
+
+        m_early_delays[0].process_delay(sig_left);
+        m_early_delays[1].process_delay(sig_right);
 
-        Stereo out = {{early[0] * 0.5f, early[1] * 0.5f}};
+        m_early_allpasses[4].process_allpass(sig_left);
+        m_early_allpasses[5].process_allpass(sig_left);
+        m_early_allpasses[6].process_allpass(sig_right);
+        m_early_allpasses[7].process_allpass(sig_right);
+        rotate_lanes(sig_left, sig_right);
 
-        float haas_multiplier = -0.6f;
+        const Float4 half(0.5f);
+        for (int lane = 0; lane < N; lane += 4) {
+            (Float4::load(left + lane) + Float4::load(sig_left + lane) * half).store(left + lane);
+            (Float4::load(right + lane) + Float4::load(sig_right + lane) * half).store(right + lane);
+        }
+    }
+
+    // See NHHall::process_outputs. This runs before the late network writes
+    // the current sample, so the taps only see earlier samples, as there.
+    inline void process_outputs(
+        const float* early_left,
+        const float* early_right,
+        int i,
+        float* const* out_left,
+        float* const* out_right
+    ) {
+        float out[2][N];
+        const Float4 half(0.5f);
+        for (int lane = 0; lane < N; lane += 4) {
+            (Float4::load(early_left + lane) * half).store(out[0] + lane);
+            (Float4::load(early_right + lane) * half).store(out[1] + lane);
+        }
+        for (int j = 0; j < 8; j++) {
+            BankDelay<N>& delay = m_late_delays[m_output_taps[j].delay];
+            const float* tap = delay.row(delay.m_read_position - m_output_tap_offsets[j]);
+            float* channel = out[m_output_taps[j].channel];
+            const Float4 gain(m_output_taps[j].gain);
+            for (int lane = 0; lane < N; lane += 4) {
+                (Float4::load(channel + lane) + Float4::load(tap + lane) * gain).store(channel + lane);
+            }
+        }
+        for (int lane = 0; lane < N; lane++) {
+            out_left[lane][i] = out[0][lane];
+            out_right[lane][i] = out[1][lane];
+        }
+    }
 
-        out[0] += m_late_delays[0].tap(0.0e-3f);
-        out[1] += m_late_delays[0].tap(0.3e-3f) * haas_multiplier;
+    // See NHHall::process_late.
+    inline void process_late(const float* early_left, const float* early_right) {
+        float* lfo_sin = m_lfo_sin;
+        float* lfo_cos = m_lfo_cos;
+        if (m_mod_control_period > 1) {
+            if (m_mod_control_restart) {
+                for (int lane = 0; lane < N; lane++) {
+                    Stereo value = lfo(lane).advance(0);
+                    lfo_sin[lane] = value[0];
+                    lfo_cos[lane] = value[1];
+                }
+                m_mod_control_timeout = 0;
+                m_mod_control_restart = false;
+            }
+            if (m_mod_control_timeout <= 0) {
+                float scale = 1.0f / m_mod_control_period;
+                for (int lane = 0; lane < N; lane++) {
+                    Stereo value = lfo(lane).advance(m_mod_control_period);
+                    m_lfo_sin_step[lane] = (value[0] - lfo_sin[lane]) * scale;
+                    m_lfo_cos_step[lane] = (value[1] - lfo_cos[lane]) * scale;
+                }
+                m_mod_control_timeout = m_mod_control_period;
+            }
+            m_mod_control_timeout -= 1;
+            for (int lane = 0; lane < N; lane += 4) {
+                (Float4::load(lfo_sin + lane) + Float4::load(m_lfo_sin_step + lane)).store(lfo_sin + lane);
+                (Float4::load(lfo_cos + lane) + Float4::load(m_lfo_cos_step + lane)).store(lfo_cos + lane);
+            }
+        } else {
+            for (int lane = 0; lane < N; lane++) {
+                Stereo value = lfo(lane).process();
+                lfo_sin[lane] = value[0];
+                lfo_cos[lane] = value[1];
+            }
+        }
 
-        out[0] += m_late_delays[1].tap(0.0e-3f);
-        out[1] += m_late_delays[1].tap(0.1e-3f) * haas_multiplier;
+        // Late delay outputs, damped, see NHHall::process_late_path.
+        float damped[4][N];
+        for (int j = 0; j < 4; j++) {
+            BankDelay<N>& delay = m_late_delays[j];
+            const float* read = delay.row(delay.m_read_position - delay.m_delay_in_samples);
+            float* s1 = m_damping_s1[j];
+            float* s2 = m_damping_s2[j];
+            for (int lane = 0; lane < N; lane += 4) {
+                Float4 in = Float4::load(read + lane);
+                Float4 a1 = Float4::load(m_damping_a1 + lane);
+                Float4 a2 = Float4::load(m_damping_a2 + lane);
+                Float4 out = Float4::load(m_damping_b0 + lane) * in + Float4::load(s1 + lane);
+                (Float4::load(m_damping_b1 + lane) * in - a1 * out + Float4::load(s2 + lane)).store(s1 + lane);
+                (Float4::load(m_damping_b2 + lane) * in - a2 * out).store(s2 + lane);
+                out.store(damped[j] + lane);
+            }
+        }
 
-        out[0] += m_late_delays[2].tap(0.7e-3f) * haas_multiplier;
-        out[1] += m_late_delays[2].tap(0.0e-3f);
+        float sig[4][N];
+        for (int lane = 0; lane < N; lane += 4) {
+            Float4 left = Float4::load(early_left + lane);
+            Float4 right = Float4::load(early_right + lane);
+            (Float4::load(m_feedback_left + lane) + left).store(sig[0] + lane);
+            (Float4::load(damped[0] + lane) + left).store(sig[1] + lane);
+            (Float4::load(m_feedback_right + lane) + right).store(sig[2] + lane);
+            (Float4::load(damped[2] + lane) + right).store(sig[3] + lane);
+        }
 
-        out[0] += m_late_delays[3].tap(0.2e-3f) * haas_multiplier;
-        out[1] += m_late_delays[3].tap(0.0e-3f);
+        for (int lane = 0; lane < N; lane += 4) {
+            Float4 x0 = Float4::load(damped[1] + lane);
+            Float4 x1 = Float4::load(damped[3] + lane);
+            Float4 cos = Float4::load(m_rotate_cos + lane);
+            Float4 sin = Float4::load(m_rotate_sin + lane);
+            flush_denormals(cos * x0 - sin * x1).store(m_feedback_left + lane);
+            flush_denormals(sin * x0 + cos * x1).store(m_feedback_right + lane);
+        }
 
-        return out;
+        const float* lfos[4] = {lfo_sin, lfo_cos, lfo_sin, lfo_cos};
+        const float lfo_signs[4] = {-1.0f, -1.0f, 1.0f, 1.0f};
+        for (int j = 0; j < 4; j++) {
+            m_late_variable_allpasses[j].process_variable_allpass(
+                sig[j], lfos[j], lfo_signs[j], m_sample_rate
+            );
+            m_late_allpasses[j].process_allpass(sig[j]);
+            BankDelay<N>& delay = m_late_delays[j];
+            float* write = delay.row(delay.m_read_position);
+            for (int lane = 0; lane < N; lane += 4) {
+                (Float4::load(sig[j] + lane) * Float4::load(m_k + lane)).store(write + lane);
+            }
+            delay.advance();
+        }
     }
 };
 
@@ -1,5 +1,7 @@
 #include "../src/core/nh_hall.hpp"
+#include <algorithm>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <sys/time.h>
 
@@ -7,36 +9,634 @@ float rfloat(void) {
     return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
 }
 
-float bench(void) {
-    float sample_rate = 48000.0f;
+const float sample_rate = 48000.0f;
+const int samples = 120.0f * sample_rate;
+// Without a decay time the late network would only ever process silence.
+const float rt60 = 3.0f;
 
-    nh_ugens::NHHall<> core(sample_rate);
+// A stereo signal as long as the benchmark.
+struct Signal {
+    std::vector<float> left;
+    std::vector<float> right;
 
-    timeval time_before;
+    Signal() : left(samples), right(samples) { }
+};
+
+Signal make_noise(void) {
+    Signal noise;
+    for (int i = 0; i < samples; i++) {
+        noise.left[i] = rfloat();
+    }
+    for (int i = 0; i < samples; i++) {
+        noise.right[i] = rfloat();
+    }
+    return noise;
+}
+
+float elapsed_since(const timeval& time_before) {
     timeval time_after;
+    gettimeofday(&time_after, 0);
+    long elapsed_microseconds = (time_after.tv_sec - time_before.tv_sec) * 1000000 + time_after.tv_usec - time_before.tv_usec;
+    return (float)elapsed_microseconds * 1e-6;
+}
+
+enum class StorageType {
+    float32,
+    half,
+    int16
+};
+
+enum class InterpolationType {
+    linear,
+    allpass,
+    cubic,
+    lagrange
+};
+
+// The predelay, tilt and dry/wet mix. At its defaults, the output stage is
+// switched on but set to do nothing, which should leave the output exactly
+// as without it.
+enum class OutputStage {
+    off,
+    defaults,
+    mixed
+};
+
+// Parameter changes made before every block, the way a host forwards
+// automation: the same values posted every time, new ones posted, or the
+// same new ones made with the setters, which the posted ones should match
+// exactly, since both land on the block boundary. Events are four
+// timestamped rt60 changes per block, the way a sequencer automates it;
+// one sample at a time they are made with set_rt60 between process()
+// calls instead, which the events should match exactly.
+enum class Automation {
+    none,
+    unchanged,
+    posted,
+    setters,
+    events
+};
+
+// One way of running the reverb over the input. Every benchmark case below
+// is one of these.
+struct Config {
+    StorageType storage = StorageType::float32;
+    InterpolationType interpolation = InterpolationType::cubic;
+    nh_ugens::BufferMode buffer_mode = nh_ugens::BufferMode::power_of_two;
+    nh_ugens::LateRate late_rate = nh_ugens::LateRate::full;
+    int block_size = 512;
+    // Call process() for every sample instead of process_block(). The
+    // block size then only spaces out the automation.
+    bool per_sample = false;
+    // Round-robin over this many instances, the way a mixer would run
+    // them. Each renders the same part of the input, so that all of them
+    // together render as much audio as a single instance.
+    int instances = 1;
+    // The same instances as one NHHallBank.
+    bool bank = false;
+    int mod_control_period = 1;
+    bool modulated = true;
+    bool shelves = false;
+    bool dc_blocker = false;
+    bool auto_sleep = false;
+    OutputStage output_stage = OutputStage::off;
+    Automation automation = Automation::none;
+    float smoothing_time = 0.0f;
+};
+
+template <class Core>
+void configure(Core& core, const Config& config) {
+    core.set_smoothing_time(config.smoothing_time);
+    core.set_mod_control_period(config.mod_control_period);
+    if (!config.modulated) {
+        core.set_mod_depth(0.0f);
+    }
+    core.set_dc_blocker(config.dc_blocker);
+    core.set_auto_sleep(config.auto_sleep);
+    if (config.output_stage == OutputStage::defaults) {
+        core.set_predelay(0.0f);
+        core.set_tilt(1000.0f, 0.0f);
+        core.set_dry_wet(0.0f, 1.0f);
+        core.set_output_gain(1.0f);
+    } else if (config.output_stage == OutputStage::mixed) {
+        core.set_predelay(0.05f);
+        core.set_tilt(1000.0f, -3.0f);
+        core.set_dry_wet(0.7f, 0.5f);
+    }
+    // The decay time last, so that the shelves have to follow it.
+    if (config.shelves) {
+        core.set_low_shelf_parameters(200.0f, 2.0f);
+        core.set_hi_shelf_parameters(4000.0f, 0.5f);
+    }
+    core.set_rt60(rt60);
+}
+
+// Four rt60 events per block, at offsets that split the chunks.
+void make_events(int frames, nh_ugens::ParameterEvent* events) {
+    for (int j = 0; j < 4; j++) {
+        events[j].offset = (2 * j + 1) * frames / 8 + 3;
+        events[j].change.parameter = nh_ugens::Parameter::rt60;
+        events[j].change.value = rt60 + (j % 2) * 0.5f;
+        events[j].change.value2 = 0.0f;
+    }
+}
+
+// rt60 and both shelves, changing every block or not, see Automation.
+template <class Core>
+void automate(Core& core, const Config& config, int block) {
+    float offset = config.automation == Automation::unchanged ? 0.0f : (block % 100) * 0.01f;
+    if (config.automation == Automation::setters) {
+        core.set_rt60(rt60 + offset);
+        core.set_low_shelf_parameters(200.0f, 0.5f + offset);
+        core.set_hi_shelf_parameters(4000.0f, 0.5f + offset);
+    } else if (config.automation == Automation::unchanged || config.automation == Automation::posted) {
+        core.post_parameter(nh_ugens::Parameter::rt60, rt60 + offset);
+        core.post_parameter(nh_ugens::Parameter::low_shelf, 200.0f, 0.5f + offset);
+        core.post_parameter(nh_ugens::Parameter::hi_shelf, 4000.0f, 0.5f + offset);
+    }
+}
+
+// process() on every sample, with the events made as set_rt60 calls in
+// between.
+template <class Core>
+void render_samples(Core& core, const float* in_left, const float* in_right, float* out_left, float* out_right, int frames, const nh_ugens::ParameterEvent* events, int event_count) {
+    int next = 0;
+    for (int i = 0; i < frames; i++) {
+        while (next < event_count && events[next].offset == i) {
+            core.set_rt60(events[next].change.value);
+            next++;
+        }
+        std::array<float, 2> out = core.process(in_left[i], in_right[i]);
+        out_left[i] = out[0];
+        out_right[i] = out[1];
+    }
+}
+
+template <class Core>
+void render_block(Core& core, const Config& config, const float* in_left, const float* in_right, float* out_left, float* out_right, int frames) {
+    nh_ugens::ParameterEvent events[4];
+    int event_count = 0;
+    if (config.automation == Automation::events) {
+        make_events(frames, events);
+        event_count = 4;
+    }
 
+    if (config.per_sample) {
+        render_samples(core, in_left, in_right, out_left, out_right, frames, events, event_count);
+    } else {
+        core.process_block(in_left, in_right, out_left, out_right, frames, events, event_count);
+    }
+}
+
+template <class Storage, class Interpolation>
+float render_with(const Config& config, const Signal& in, Signal& out) {
+    typedef nh_ugens::NHHall<nh_ugens::Allocator, Storage, Interpolation> Core;
+    float max_predelay = config.output_stage == OutputStage::off ? 0.0f : 0.1f;
+    std::vector<Core> cores;
+    for (int i = 0; i < config.instances; i++) {
+        cores.emplace_back(sample_rate, config.buffer_mode, config.late_rate, max_predelay);
+        configure(cores.back(), config);
+    }
+
+    // With the output stage on, process in place, as an insert effect.
+    const Signal& source = config.output_stage == OutputStage::off ? in : out;
+    if (config.output_stage != OutputStage::off) {
+        out = in;
+    }
+
+    timeval time_before;
     gettimeofday(&time_before, 0);
 
-    int samples = 120.0f * sample_rate;
-    for (int i = 0; i < samples; i++) {
-        float out_1;
-        float out_2;
-        std::array<float, 2> out = core.process(rfloat(), rfloat());
-        out_1 = out[0];
-        out_2 = out[1];
+    int samples_per_instance = samples / config.instances;
+    for (int i = 0; i < samples_per_instance; i += config.block_size) {
+        int frames = std::min(config.block_size, samples_per_instance - i);
+        for (auto& core : cores) {
+            automate(core, config, i / config.block_size);
+            render_block(
+                core, config, &source.left[i], &source.right[i], &out.left[i], &out.right[i], frames
+            );
+        }
     }
-    gettimeofday(&time_after, 0);
 
-    long elapsed_microseconds = (time_after.tv_sec - time_before.tv_sec) * 1000000 + time_after.tv_usec - time_before.tv_usec;
-    float elapsed = (float)elapsed_microseconds * 1e-6;
+    return elapsed_since(time_before);
+}
+
+template <int N>
+float render_bank(const Config& config, const Signal& in, Signal& out) {
+    nh_ugens::NHHallBank<N> bank(sample_rate, config.buffer_mode);
+    for (int lane = 0; lane < N; lane++) {
+        if (config.shelves) {
+            bank.set_low_shelf_parameters(lane, 200.0f, 2.0f);
+            bank.set_hi_shelf_parameters(lane, 4000.0f, 0.5f);
+        }
+        bank.set_rt60(lane, rt60);
+    }
+
+    timeval time_before;
+    gettimeofday(&time_before, 0);
+
+    int samples_per_instance = samples / N;
+    for (int i = 0; i < samples_per_instance; i += config.block_size) {
+        int frames = std::min(config.block_size, samples_per_instance - i);
+        const float* lane_in_left[N];
+        const float* lane_in_right[N];
+        float* lane_out_left[N];
+        float* lane_out_right[N];
+        for (int lane = 0; lane < N; lane++) {
+            lane_in_left[lane] = &in.left[i];
+            lane_in_right[lane] = &in.right[i];
+            lane_out_left[lane] = &out.left[i];
+            lane_out_right[lane] = &out.right[i];
+        }
+        bank.process_block(lane_in_left, lane_in_right, lane_out_left, lane_out_right, frames);
+    }
+
+    return elapsed_since(time_before);
+}
+
+// Render in into out as config says, and return the time it took.
+float render(const Config& config, const Signal& in, Signal& out) {
+    using namespace nh_ugens;
+    if (config.bank) {
+        return render_bank<8>(config, in, out);
+    }
+    switch (config.interpolation) {
+        case InterpolationType::linear:
+            return render_with<FloatStorage, LinearInterpolation>(config, in, out);
+        case InterpolationType::allpass:
+            return render_with<FloatStorage, AllpassInterpolation>(config, in, out);
+        case InterpolationType::lagrange:
+            return render_with<FloatStorage, LagrangeInterpolation>(config, in, out);
+        case InterpolationType::cubic:
+            break;
+    }
+    switch (config.storage) {
+        case StorageType::half:
+            return render_with<HalfStorage, CubicInterpolation>(config, in, out);
+        case StorageType::int16:
+            return render_with<Int16Storage, CubicInterpolation>(config, in, out);
+        case StorageType::float32:
+            break;
+    }
+    return render_with<FloatStorage, CubicInterpolation>(config, in, out);
+}
+
+// Over both channels. NaN if either side went NaN or infinite, which
+// std::max would skip.
+float max_difference(const Signal& a, const Signal& b, int size) {
+    float result = 0.0f;
+    for (int i = 0; i < size; i++) {
+        float left = std::abs(a.left[i] - b.left[i]);
+        float right = std::abs(a.right[i] - b.right[i]);
+        if (std::isnan(left)) {
+            return left;
+        }
+        if (std::isnan(right)) {
+            return right;
+        }
+        result = std::max(result, std::max(left, right));
+    }
+    return result;
+}
+
+void report(const std::string& label, float elapsed) {
+    std::cout << label << ": took " << elapsed << " seconds" << std::endl;
+}
+
+void report(const std::string& label, float elapsed, const std::string& expected_name, float difference) {
+    std::cout
+        << label << ": took " << elapsed
+        << " seconds, max difference from " << expected_name << " = " << difference
+        << std::endl;
+}
 
-    return elapsed;
+// Render config into out, print how long it took, and, if given, how far
+// the first compared samples are from expected.
+void run_case(
+    const std::string& label,
+    const Config& config,
+    const Signal& in,
+    Signal& out,
+    const Signal* expected = nullptr,
+    const std::string& expected_name = "process()",
+    int compared = samples
+) {
+    float elapsed = render(config, in, out);
+    if (expected == nullptr) {
+        report(label, elapsed);
+    } else {
+        report(label, elapsed, expected_name, max_difference(out, *expected, compared));
+    }
+}
+
+// Average time of a reset after every block_size samples, the way a voice
+// allocator would reuse an instance for short notes. Afterwards, renders
+// the first reset_check_samples of the input once more, which should match
+// a fresh instance exactly.
+const int reset_check_samples = 10.0f * sample_rate;
+
+float bench_reset(const Signal& in, Signal& out, int block_size) {
+    nh_ugens::NHHall<> core(sample_rate);
+    core.set_rt60(rt60);
+
+    float elapsed = 0.0f;
+    int resets = 0;
+    for (int i = 0; i + block_size <= samples; i += block_size) {
+        core.process_block(&in.left[i], &in.right[i], &out.left[i], &out.right[i], block_size);
+
+        timeval time_before;
+        gettimeofday(&time_before, 0);
+        core.reset();
+        elapsed += elapsed_since(time_before);
+        resets++;
+    }
+
+    for (int i = 0; i < reset_check_samples; i += block_size) {
+        int frames = std::min(block_size, reset_check_samples - i);
+        core.process_block(&in.left[i], &in.right[i], &out.left[i], &out.right[i], frames);
+    }
+
+    return elapsed / resets;
+}
+
+// A short reverb per voice of a synth playing a 250 ms note every 500 ms,
+// with a pool of 16 voices. Only the voices that are held or still ringing
+// are processed. Reports the average number of those.
+float bench_pool(const Signal& in, Signal& out, float& average_active) {
+    const int block_size = 128;
+    const int note_length = 0.25f * sample_rate;
+    const int note_interval = 0.5f * sample_rate;
+    std::vector<float> silence(block_size, 0.0f);
+
+    nh_ugens::NHHallPool<16> pool(sample_rate);
+    for (int i = 0; i < 16; i++) {
+        pool.voice(i).set_rt60(1.0f);
+    }
+    // The sample each voice's note started at, or -1.
+    std::vector<int> note_start(16, -1);
+    long active = 0;
+
+    timeval time_before;
+    gettimeofday(&time_before, 0);
+
+    for (int i = 0; i + block_size <= samples; i += block_size) {
+        if (i % note_interval < block_size) {
+            note_start[pool.acquire()] = i;
+        }
+        for (int voice = 0; voice < 16; voice++) {
+            if (note_start[voice] >= 0 && i - note_start[voice] >= note_length) {
+                pool.release(voice);
+                note_start[voice] = -1;
+            }
+            if (!pool.is_active(voice)) {
+                continue;
+            }
+            active++;
+            bool held = note_start[voice] >= 0;
+            pool.voice(voice).process_block(
+                held ? &in.left[i] : silence.data(),
+                held ? &in.right[i] : silence.data(),
+                &out.left[i],
+                &out.right[i],
+                block_size
+            );
+        }
+    }
+
+    average_active = static_cast<float>(active) / (samples / block_size);
+    return elapsed_since(time_before);
+}
+
+// The sine and cosine outputs go to the left and right channels.
+float bench_lfo(Signal& out, bool exact) {
+    nh_ugens::RandomLFO lfo(sample_rate);
+    lfo.set_exact(exact);
+
+    timeval time_before;
+    gettimeofday(&time_before, 0);
+
+    for (int i = 0; i < samples; i += 128) {
+        int frames = std::min(128, samples - i);
+        lfo.process(&out.left[i], &out.right[i], frames);
+    }
+
+    return elapsed_since(time_before);
 }
 
 int main(void) {
+    Signal in = make_noise();
+    // What process() makes of the input, which most cases should match.
+    Signal reference;
+    Signal out;
+    // For comparisons against something other than process().
+    Signal check;
+
+    std::cout
+        << "NHHall needs " << nh_ugens::NHHall<>::required_bytes(sample_rate)
+        << " bytes per instance with power-of-two buffers, "
+        << nh_ugens::NHHall<>::required_bytes(sample_rate, nh_ugens::BufferMode::exact)
+        << " with exact buffers. NHHallBank<8> needs "
+        << nh_ugens::NHHallBank<8>::required_bytes(sample_rate) << " bytes"
+        << std::endl;
+    std::cout
+        << "With half storage NHHall needs "
+        << nh_ugens::NHHall<nh_ugens::Allocator, nh_ugens::HalfStorage>::required_bytes(sample_rate)
+        << " bytes, with int16 storage "
+        << nh_ugens::NHHall<nh_ugens::Allocator, nh_ugens::Int16Storage>::required_bytes(sample_rate)
+        << std::endl;
+    std::cout
+        << "With the late network at half rate NHHall needs "
+        << nh_ugens::NHHall<>::required_bytes(sample_rate, nh_ugens::BufferMode::power_of_two, nh_ugens::LateRate::half)
+        << " bytes, at quarter rate "
+        << nh_ugens::NHHall<>::required_bytes(sample_rate, nh_ugens::BufferMode::power_of_two, nh_ugens::LateRate::quarter)
+        << std::endl;
 
-    float elapsed = bench();
-    std::cout << "Took " << elapsed << " seconds to render 60s of audio." << std::endl;
+#if defined(NH_UGENS_HARDWARE_FTZ)
+    std::cout << "Denormals are flushed by the FPU." << std::endl;
+#else
+    std::cout << "Denormals are flushed in software." << std::endl;
+#endif
+
+    {
+        Config config;
+        config.per_sample = true;
+        float elapsed = render(config, in, reference);
+        std::cout << "Took " << elapsed << " seconds to render 120s of audio." << std::endl;
+    }
+
+    // One second of input and then a long decaying tail, which runs into
+    // denormals unless they are flushed, or puts the reverb to sleep.
+    {
+        const int input_length = sample_rate;
+        Signal tail = in;
+        std::fill(tail.left.begin() + input_length, tail.left.end(), 0.0f);
+        std::fill(tail.right.begin() + input_length, tail.right.end(), 0.0f);
+        Config config;
+        run_case("Decaying tail, block size 512", config, tail, out);
+        config.auto_sleep = true;
+        run_case("Decaying tail, block size 512, auto sleep", config, tail, out);
+    }
+
+    int reset_block_sizes[] = {512, 480000};
+    for (int block_size : reset_block_sizes) {
+        float elapsed = bench_reset(in, out, block_size);
+        std::cout
+            << "reset() after " << block_size << " samples: took "
+            << elapsed * 1e6 << " microseconds, max difference from a fresh instance = "
+            << max_difference(out, reference, reset_check_samples) << std::endl;
+    }
+
+    int block_sizes[] = {64, 512};
+    for (int block_size : block_sizes) {
+        Config config;
+        config.block_size = block_size;
+        run_case("Block size " + std::to_string(block_size), config, in, out, &reference);
+    }
+
+    {
+        Config config;
+        config.block_size = 64;
+        config.automation = Automation::unchanged;
+        run_case("Block size 64, unchanged parameters posted every block", config, in, out);
+    }
+    float smoothing_times[] = {0.0f, 0.02f};
+    for (float smoothing_time : smoothing_times) {
+        Config config;
+        config.block_size = 64;
+        config.smoothing_time = smoothing_time;
+        config.automation = Automation::setters;
+        render(config, in, check);
+        config.automation = Automation::posted;
+        std::string label = "Block size 64, changed parameters posted every block";
+        if (smoothing_time > 0.0f) {
+            label += ", " + std::to_string(static_cast<int>(smoothing_time * 1000.0f)) + " ms smoothing";
+        }
+        run_case(label, config, in, out, &check, "setters");
+    }
+
+    {
+        Config config;
+        config.output_stage = OutputStage::mixed;
+        run_case("Block size 512, predelay, tilt and dry/wet mix", config, in, out);
+        config.output_stage = OutputStage::defaults;
+        run_case("Block size 512, output stage at its defaults", config, in, out, &reference);
+    }
+
+    {
+        Config config;
+        config.shelves = true;
+        run_case("Block size 512, low and high shelves", config, in, out);
+        config.dc_blocker = true;
+        run_case("Block size 512, low and high shelves and DC blocker", config, in, out);
+    }
+
+    {
+        Config config;
+        config.automation = Automation::events;
+        config.per_sample = true;
+        render(config, in, check);
+        config.per_sample = false;
+        run_case(
+            "Block size 512, 4 timestamped rt60 events per block", config, in, out,
+            &check, "set_rt60() between process() calls"
+        );
+    }
+
+    int mod_control_periods[] = {16, 32};
+    for (int mod_control_period : mod_control_periods) {
+        Config config;
+        config.mod_control_period = mod_control_period;
+        run_case(
+            "Block size 512, modulation every " + std::to_string(mod_control_period) + " samples",
+            config, in, out, &reference
+        );
+    }
+
+    {
+        Config config;
+        config.buffer_mode = nh_ugens::BufferMode::exact;
+        run_case("Block size 512, exact buffers", config, in, out, &reference);
+    }
+    {
+        Config config;
+        config.storage = StorageType::half;
+        run_case("Block size 512, half storage", config, in, out, &reference);
+        config.storage = StorageType::int16;
+        run_case("Block size 512, int16 storage", config, in, out, &reference);
+    }
+    {
+        Config config;
+        config.interpolation = InterpolationType::linear;
+        run_case("Block size 512, linear interpolation", config, in, out, &reference);
+        config.interpolation = InterpolationType::allpass;
+        run_case("Block size 512, allpass interpolation", config, in, out, &reference);
+        config.interpolation = InterpolationType::lagrange;
+        run_case("Block size 512, fifth-order Lagrange interpolation", config, in, out, &reference);
+    }
+
+    {
+        Config config;
+        config.modulated = false;
+        run_case("Block size 512, mod depth 0", config, in, out);
+    }
+    {
+        Config config;
+        config.late_rate = nh_ugens::LateRate::half;
+        run_case("Block size 512, late network at half rate", config, in, out);
+        config.late_rate = nh_ugens::LateRate::quarter;
+        run_case("Block size 512, late network at quarter rate", config, in, out);
+    }
+
+    {
+        Config config;
+        config.block_size = 128;
+        config.instances = 64;
+        run_case("64 instances, block size 128", config, in, out);
+        config.buffer_mode = nh_ugens::BufferMode::exact;
+        run_case("64 instances, block size 128, exact buffers", config, in, out);
+        config.buffer_mode = nh_ugens::BufferMode::power_of_two;
+        config.storage = StorageType::half;
+        run_case("64 instances, block size 128, half storage", config, in, out);
+        config.storage = StorageType::int16;
+        run_case("64 instances, block size 128, int16 storage", config, in, out);
+    }
+
+    {
+        Config config;
+        config.block_size = 128;
+        config.instances = 8;
+        run_case("8 instances, block size 128", config, in, check);
+        config.bank = true;
+        run_case("NHHallBank<8>, block size 128", config, in, out, &check, "NHHall", samples / 8);
+
+        config.bank = false;
+        config.shelves = true;
+        render(config, in, check);
+        config.bank = true;
+        run_case(
+            "NHHallBank<8>, block size 128, low and high shelves", config, in, out,
+            &check, "NHHall", samples / 8
+        );
+    }
+
+    float average_active;
+    float elapsed = bench_pool(in, out, average_active);
+    std::cout
+        << "NHHallPool<16>, a note every 500 ms: took " << elapsed
+        << " seconds, " << average_active << " voices active on average"
+        << std::endl;
+
+    elapsed = bench_lfo(check, true);
+    report("Exact LFO", elapsed);
+    elapsed = bench_lfo(out, false);
+    float amplitude = 0.0f;
+    for (float value : check.left) {
+        amplitude = std::max(amplitude, std::abs(value));
+    }
+    std::cout
+        << "Quadrature LFO: took " << elapsed
+        << " seconds, max difference from exact = " << max_difference(out, check, samples) / amplitude
+        << " of the amplitude" << std::endl;
 
     return 0;
 }
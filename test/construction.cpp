@@ -0,0 +1,92 @@
+#include "../src/core/nh_hall.hpp"
+#include <iostream>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const float sample_rate = 48000.0f;
+const int instances = 500;
+const int block_size = 512;
+
+// Like the default allocator, but without allocate_zeroed, so NHHall has to
+// clear the delay lines itself.
+class MallocAllocator {
+public:
+    void* allocate(int memory_size) {
+        return malloc(memory_size);
+    }
+
+    void deallocate(void* memory) {
+        free(memory);
+    }
+};
+
+float elapsed_since(const timeval& time_before) {
+    timeval time_after;
+    gettimeofday(&time_after, 0);
+    long elapsed_microseconds = (time_after.tv_sec - time_before.tv_sec) * 1000000 + time_after.tv_usec - time_before.tv_usec;
+    return (float)elapsed_microseconds * 1e-6;
+}
+
+// Peak resident set size of this process in MB.
+float peak_rss(void) {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / (1024.0f * 1024.0f);
+#else
+    return usage.ru_maxrss / 1024.0f;
+#endif
+}
+
+// Construct the instances, then run one block of audio through each. Runs
+// in a child process so that every case starts from the same peak RSS.
+template <class Alloc>
+void bench_construction(const char* name) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid != 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    typedef nh_ugens::NHHall<Alloc> Core;
+    std::vector<std::unique_ptr<Core>> cores(instances);
+    float rss_before = peak_rss();
+
+    timeval time_before;
+    gettimeofday(&time_before, 0);
+    for (int i = 0; i < instances; i++) {
+        cores[i].reset(new Core(sample_rate, Alloc()));
+    }
+    float elapsed = elapsed_since(time_before);
+    float rss_constructed = peak_rss();
+
+    std::vector<float> in(block_size, 0.5f);
+    std::vector<float> out_left(block_size);
+    std::vector<float> out_right(block_size);
+    for (int i = 0; i < instances; i++) {
+        cores[i]->process_block(in.data(), in.data(), out_left.data(), out_right.data(), block_size);
+    }
+    float rss_processed = peak_rss();
+
+    std::cout
+        << instances << " instances, " << name << ": took " << elapsed
+        << " seconds to construct, peak RSS grew by "
+        << rss_constructed - rss_before << " MB, "
+        << rss_processed - rss_before << " MB after one block"
+        << std::endl;
+    exit(0);
+}
+
+int main(void) {
+    std::cout
+        << "Each instance needs "
+        << nh_ugens::NHHall<>::required_bytes(sample_rate) << " bytes"
+        << std::endl;
+    bench_construction<MallocAllocator>("malloc and memset");
+    bench_construction<nh_ugens::Allocator>("allocate_zeroed");
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "../src/core/nh_hall.hpp"
+#include "../src/core/nh_arena.hpp"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+const float sample_rate = 48000.0f;
+const int instances = 64;
+const int block_size = 64;
+// Long enough for every delay line to have wrapped around.
+const int first_pass_blocks = 1.0f * sample_rate / block_size;
+const int blocks = 5.0f * sample_rate / block_size;
+
+float rfloat(void) {
+    return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+}
+
+double now(void) {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+long page_faults(void) {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+// The worst time, and the one that 99.9% of the blocks beat, which is less
+// at the mercy of the scheduler.
+void print_times(const char* when, std::vector<double>& times) {
+    std::sort(times.begin(), times.end());
+    std::cout
+        << when << " worst " << times.back() * 1e6 << " us, 99.9% "
+        << times[times.size() * 999 / 1000] * 1e6 << " us";
+}
+
+template <class Alloc>
+Alloc make_allocator(nh_ugens::Arena&) {
+    return Alloc();
+}
+
+template <>
+nh_ugens::ArenaAllocator make_allocator(nh_ugens::Arena& arena) {
+    return nh_ugens::ArenaAllocator(arena);
+}
+
+// Time every block of every instance, and report the slowest blocks while
+// the delay lines are first written, and after that, along with the page
+// faults taken in each phase. Runs in a child
+// process so that every case starts with the same memory.
+template <class Alloc>
+void bench_latency(const char* name, bool use_arena) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid != 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    typedef nh_ugens::NHHall<Alloc> Core;
+    nh_ugens::Arena arena(use_arena ? instances * (Core::required_bytes(sample_rate) + nh_ugens::Arena::k_alignment) : 0);
+    std::vector<std::unique_ptr<Core>> cores(instances);
+    for (int i = 0; i < instances; i++) {
+        cores[i].reset(new Core(sample_rate, make_allocator<Alloc>(arena)));
+        cores[i]->set_rt60(3.0f);
+        if (!cores[i]->m_initialization_was_successful) {
+            std::cout << name << ": out of memory" << std::endl;
+            exit(1);
+        }
+    }
+
+    std::vector<float> in_left(block_size);
+    std::vector<float> in_right(block_size);
+    std::vector<float> out_left(block_size);
+    std::vector<float> out_right(block_size);
+    std::vector<double> first_pass_times;
+    std::vector<double> steady_times;
+    // Touch them now, so that they don't fault during the measurement.
+    first_pass_times.assign(first_pass_blocks * instances, 0.0);
+    steady_times.assign((blocks - first_pass_blocks) * instances, 0.0);
+    first_pass_times.clear();
+    steady_times.clear();
+    long first_pass_faults = 0;
+    long faults_before = page_faults();
+    for (int block = 0; block < blocks; block++) {
+        if (block == first_pass_blocks) {
+            first_pass_faults = page_faults() - faults_before;
+            faults_before = page_faults();
+        }
+        for (int i = 0; i < block_size; i++) {
+            in_left[i] = rfloat();
+            in_right[i] = rfloat();
+        }
+        for (int i = 0; i < instances; i++) {
+            double time_before = now();
+            cores[i]->process_block(in_left.data(), in_right.data(), out_left.data(), out_right.data(), block_size);
+            double elapsed = now() - time_before;
+            if (block < first_pass_blocks) {
+                first_pass_times.push_back(elapsed);
+            } else {
+                steady_times.push_back(elapsed);
+            }
+        }
+    }
+
+    std::cout << name;
+    if (use_arena) {
+        std::cout
+            << (arena.uses_huge_pages() ? " (huge pages" : " (normal pages")
+            << (arena.is_locked() ? ", locked)" : ", not locked)");
+    }
+    long steady_faults = page_faults() - faults_before;
+    std::cout << std::endl;
+    print_times("    First second:", first_pass_times);
+    std::cout << ", " << first_pass_faults << " page faults" << std::endl;
+    print_times("    After:", steady_times);
+    std::cout << ", " << steady_faults << " page faults" << std::endl;
+    exit(0);
+}
+
+int main(void) {
+    std::cout
+        << instances << " instances, block size " << block_size
+        << ", times per block and instance" << std::endl;
+    bench_latency<nh_ugens::Allocator>("Default allocator", false);
+    bench_latency<nh_ugens::ArenaAllocator>("Arena", true);
+    return 0;
+}
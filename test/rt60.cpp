@@ -1,9 +1,12 @@
 #include "../src/core/nh_hall.hpp"
 #include <iostream>
+#include <vector>
 
+const float sample_rate = 48000.0f;
+
+template <class Storage = nh_ugens::FloatStorage>
 void find_rt60(float k, float time) {
-    float sample_rate = 48000.0f;
-    nh_ugens::NHHall<> core(sample_rate);
+    nh_ugens::NHHall<nh_ugens::Allocator, Storage> core(sample_rate);
 
     core.m_k = k;
 
@@ -50,6 +53,53 @@ void find_rt60(float k, float time) {
     << std::endl;
 }
 
+// Impulse response of the left output.
+template <class Storage>
+std::vector<float> render_impulse(float k, float time) {
+    nh_ugens::NHHall<nh_ugens::Allocator, Storage> core(sample_rate);
+    core.m_k = k;
+
+    int samples = sample_rate * time;
+    std::vector<float> left(samples, 0.0f);
+    std::vector<float> right(samples, 0.0f);
+    left[0] = right[0] = 1.0f;
+    core.process_block(left.data(), right.data(), samples);
+    return left;
+}
+
+float rms_db(const std::vector<float>& x, int start, int end) {
+    double sum = 0.0;
+    for (int i = start; i < end; i++) {
+        sum += static_cast<double>(x[i]) * x[i];
+    }
+    return 10.0 * log10(sum / (end - start) + 1e-30);
+}
+
+// How far a storage format's impulse response is from the float one, and
+// where its tail ends up once the float tail has decayed into nothing.
+template <class Storage>
+void find_noise_floor(const char* name, float k, const std::vector<float>& reference) {
+    std::vector<float> out = render_impulse<Storage>(k, reference.size() / sample_rate);
+
+    int one_second = sample_rate;
+    std::vector<float> error(one_second);
+    for (int i = 0; i < one_second; i++) {
+        error[i] = out[i] - reference[i];
+    }
+    int size = out.size();
+
+    std::cout
+    << name << ", k = " << k
+    << ": error in the first second at "
+    << rms_db(error, 0, one_second) << " dB, "
+    << rms_db(error, 0, one_second) - rms_db(reference, 0, one_second)
+    << " dB relative to the response, tail after "
+    << size / one_second - 1 << "s at "
+    << rms_db(out, size - one_second, size) << " dB (float: "
+    << rms_db(reference, size - one_second, size) << " dB)"
+    << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     find_rt60(0.5f, 0.1f);
     find_rt60(0.6f, 0.1f);
@@ -61,5 +111,15 @@ int main(int argc, char* argv[]) {
     find_rt60(0.96f, 0.1f);
     find_rt60(0.99f, 0.1f);
 
+    find_rt60<nh_ugens::HalfStorage>(0.9f, 0.1f);
+    find_rt60<nh_ugens::Int16Storage>(0.9f, 0.1f);
+
+    float ks[] = {0.5f, 0.9f, 0.99f};
+    for (float k : ks) {
+        std::vector<float> reference = render_impulse<nh_ugens::FloatStorage>(k, 30.0f);
+        find_noise_floor<nh_ugens::HalfStorage>("Half", k, reference);
+        find_noise_floor<nh_ugens::Int16Storage>("Int16", k, reference);
+    }
+
     return 0;
 }